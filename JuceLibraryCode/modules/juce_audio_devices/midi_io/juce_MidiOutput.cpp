@@ -41,7 +41,8 @@ MidiOutput::MidiOutput (const String& midiName)
 {
 }
 
-void MidiOutput::sendBlockOfMessagesNow (const MidiBuffer& buffer)
+#if ! (JUCE_LINUX && JUCE_ALSA) // the ALSA version queues the whole block and drains it once
+bool MidiOutput::sendBlockOfMessagesNow (const MidiBuffer& buffer)
 {
     MidiBuffer::Iterator i (buffer);
     MidiMessage message;
@@ -49,7 +50,10 @@ void MidiOutput::sendBlockOfMessagesNow (const MidiBuffer& buffer)
 
     while (i.getNextEvent (message, samplePosition))
         sendMessageNow (message);
+
+    return true;
 }
+#endif
 
 void MidiOutput::sendBlockOfMessages (const MidiBuffer& buffer,
                                       const double millisecondCounterToStartAt,
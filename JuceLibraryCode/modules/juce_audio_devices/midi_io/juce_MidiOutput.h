@@ -87,8 +87,10 @@ public:
     /** Sends out a MIDI message immediately. */
     void sendMessageNow (const MidiMessage& message);
 
-    /** Sends out a sequence of MIDI messages immediately. */
-    void sendBlockOfMessagesNow (const MidiBuffer& buffer);
+    /** Sends out a sequence of MIDI messages immediately.
+        Returns false if the device did not take all of them (only detected on ALSA).
+    */
+    bool sendBlockOfMessagesNow (const MidiBuffer& buffer);
 
     //==============================================================================
     /** This lets you supply a block of messages that will be sent out at some point
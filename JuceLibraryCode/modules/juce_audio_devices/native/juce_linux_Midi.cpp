@@ -110,6 +110,75 @@ public:
         }
 
         bool sendMessageNow (const MidiMessage& message)
+        {
+            return outputMessage (message, true);
+        }
+
+        // Writes all the events to the client output buffer, and then drains it once.
+        // Returns false if any of them could not be sent
+        bool sendMessagesNow (const MidiBuffer& buffer)
+        {
+            MidiBuffer::Iterator i (buffer);
+            MidiMessage message;
+            int samplePosition;
+            bool success = true;
+
+            while (i.getNextEvent (message, samplePosition))
+            {
+                if (! outputMessage (message, false))
+                {
+                    success = false;
+                    break;
+                }
+            }
+
+            if (! drainOutput())
+                success = false;
+
+            return success;
+        }
+
+        // The client is non-blocking, so the sequencer refuses events with -EAGAIN while its pool is full.
+        // Waits until it has room again, or until the deadline (a millisecond counter) has passed.
+        // The deadline is set on the first wait, so the sends that don't need to wait don't read the clock
+        bool waitForOutputRoom (uint32& deadline) const
+        {
+            const uint32 now = Time::getMillisecondCounter();
+
+            if (deadline == 0)
+                deadline = now + outputTimeoutMs;
+            else if (now >= deadline)
+                return false;
+
+            snd_seq_t* seqHandle = client.get();
+            auto numPfds = snd_seq_poll_descriptors_count (seqHandle, POLLOUT);
+            HeapBlock<pollfd> pfd (numPfds);
+            snd_seq_poll_descriptors (seqHandle, pfd, (unsigned int) numPfds, POLLOUT);
+
+            return poll (pfd, (nfds_t) numPfds, (int) (deadline - now)) > 0;
+        }
+
+        // Sends everything in the client output buffer. If the sequencer doesn't take it all in time, the rest
+        // is dropped, instead of going out later with the next drain, after events that were sent after it
+        bool drainOutput()
+        {
+            snd_seq_t* seqHandle = client.get();
+            uint32 deadline = 0;
+            int err;
+
+            while ((err = snd_seq_drain_output (seqHandle)) != 0)
+            {
+                if ((err > 0 || err == -EAGAIN) && waitForOutputRoom (deadline))
+                    continue;
+
+                snd_seq_drop_output (seqHandle);
+                return false;
+            }
+
+            return true;
+        }
+
+        bool outputMessage (const MidiMessage& message, bool direct)
         {
             if (message.getRawDataSize() > maxEventSize)
             {
@@ -125,6 +194,7 @@ public:
             const uint8* data = message.getRawData();
 
             snd_seq_t* seqHandle = client.get();
+            uint32 deadline = 0;
             bool success = true;
 
             while (numBytes > 0)
@@ -144,7 +214,16 @@ public:
                 snd_seq_ev_set_subs (&event);
                 snd_seq_ev_set_direct (&event);
 
-                if (snd_seq_event_output_direct (seqHandle, &event) < 0)
+                int err;
+
+                // A full buffer or pool rejects the event, it is not queued, so it can just be tried again
+                while ((err = direct ? snd_seq_event_output_direct (seqHandle, &event)
+                                     : snd_seq_event_output (seqHandle, &event)) == -EAGAIN
+                       && waitForOutputRoom (deadline))
+                {
+                }
+
+                if (err < 0)
                 {
                     success = false;
                     break;
@@ -165,6 +244,9 @@ public:
         bool callbackEnabled;
 
     private:
+        // How long a send waits for the sequencer to make room before giving up
+        static const uint32 outputTimeoutMs = 100;
+
         friend class AlsaClient;
 
         AlsaClient& client;
@@ -519,6 +601,11 @@ void MidiOutput::sendMessageNow (const MidiMessage& message)
     static_cast<AlsaClient::Port*> (internal)->sendMessageNow (message);
 }
 
+bool MidiOutput::sendBlockOfMessagesNow (const MidiBuffer& buffer)
+{
+    return static_cast<AlsaClient::Port*> (internal)->sendMessagesNow (buffer);
+}
+
 //==============================================================================
 MidiInput::MidiInput (const String& nm)
     : name (nm), internal (nullptr)
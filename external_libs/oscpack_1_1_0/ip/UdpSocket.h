@@ -117,6 +117,10 @@ public:
 	// for calls to Send()
 	void Connect( const IpEndpointName& remoteEndpoint );	
 	void Send( const char *data, std::size_t size );
+	// Send count datagrams to the connected endpoint. On Linux they are
+	// passed to the kernel together with sendmmsg(). Returns the number
+	// of system calls that were needed
+	int SendMultiple( const char * const *data, const std::size_t *sizes, int count );
     void SendTo( const IpEndpointName& remoteEndpoint, const char *data, std::size_t size );
 
 
@@ -46,6 +46,13 @@
 #include <sys/time.h>
 #include <netinet/in.h> // for sockaddr_in
 
+#if defined(__linux__) && !defined(OSCPACK_NO_EPOLL)
+// on Linux the receive multiplexer waits with epoll and drains every readable
+// socket with recvmmsg(), receiving a batch of datagrams per system call
+#define OSCPACK_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #include <signal.h>
 #include <math.h>
 #include <errno.h>
@@ -206,6 +213,43 @@ public:
         send( socket_, data, size, 0 );
 	}
 
+	int SendMultiple( const char * const *data, const std::size_t *sizes, int count )
+	{
+		assert( isConnected_ );
+
+#if defined(__linux__)
+		const int MAX_DATAGRAMS_PER_SEND = 64;
+		struct mmsghdr messages[ MAX_DATAGRAMS_PER_SEND ];
+		struct iovec iovecs[ MAX_DATAGRAMS_PER_SEND ];
+		int nCalls = 0;
+		int sent = 0;
+		while( sent < count ){
+			int batch = std::min( count - sent, MAX_DATAGRAMS_PER_SEND );
+			for( int i = 0; i < batch; ++i ){
+				iovecs[i].iov_base = const_cast< char* >( data[ sent + i ] );
+				iovecs[i].iov_len = sizes[ sent + i ];
+				std::memset( &messages[i], 0, sizeof(messages[i]) );
+				messages[i].msg_hdr.msg_iov = &iovecs[i];
+				messages[i].msg_hdr.msg_iovlen = 1;
+			}
+			int result = sendmmsg( socket_, messages, batch, 0 );
+			++nCalls;
+			if( result < 0 ){
+				if( errno == EINTR )
+					continue;
+				// as with Send(), errors are not reported. skip the datagram that failed
+				result = 1;
+			}
+			sent += result;
+		}
+		return nCalls;
+#else
+		for( int i = 0; i < count; ++i )
+			send( socket_, data[i], sizes[i], 0 );
+		return count;
+#endif
+	}
+
     void SendTo( const IpEndpointName& remoteEndpoint, const char *data, std::size_t size )
 	{
 		sendToAddr_.sin_addr.s_addr = htonl( remoteEndpoint.address );
@@ -284,6 +328,11 @@ void UdpSocket::Send( const char *data, std::size_t size )
 	impl_->Send( data, size );
 }
 
+int UdpSocket::SendMultiple( const char * const *data, const std::size_t *sizes, int count )
+{
+	return impl_->SendMultiple( data, sizes, count );
+}
+
 void UdpSocket::SendTo( const IpEndpointName& remoteEndpoint, const char *data, std::size_t size )
 {
 	impl_->SendTo( remoteEndpoint, data, size );
@@ -340,6 +389,16 @@ class SocketReceiveMultiplexer::Implementation{
 	volatile bool break_;
 	int breakPipe_[2]; // [0] is the reader descriptor and [1] the writer
 
+#if defined(OSCPACK_USE_EPOLL)
+	// receive buffers are allocated once and reused by every call to Run()
+	static const int MAX_BUFFER_SIZE = 4098;
+	static const int MAX_DATAGRAMS_PER_RECEIVE = 64;
+	std::vector< char > receiveData_;
+	std::vector< struct mmsghdr > receiveMessages_;
+	std::vector< struct iovec > receiveIovecs_;
+	std::vector< struct sockaddr_in > receiveAddrs_;
+#endif
+
 	double GetCurrentTimeMs() const
 	{
 		struct timeval t;
@@ -354,6 +413,13 @@ public:
 	{
 		if( pipe(breakPipe_) != 0 )
 			throw std::runtime_error( "creation of asynchronous break pipes failed\n" );
+
+#if defined(OSCPACK_USE_EPOLL)
+		receiveData_.resize( MAX_BUFFER_SIZE * MAX_DATAGRAMS_PER_RECEIVE );
+		receiveMessages_.resize( MAX_DATAGRAMS_PER_RECEIVE );
+		receiveIovecs_.resize( MAX_DATAGRAMS_PER_RECEIVE );
+		receiveAddrs_.resize( MAX_DATAGRAMS_PER_RECEIVE );
+#endif
 	}
 
     ~Implementation()
@@ -403,6 +469,152 @@ public:
 	}
 
     void Run()
+	{
+#if defined(OSCPACK_USE_EPOLL)
+		RunEpoll();
+#else
+		RunSelect();
+#endif
+	}
+
+#if defined(OSCPACK_USE_EPOLL)
+    // receives as many datagrams as are queued on the socket (up to MAX_DATAGRAMS_PER_RECEIVE
+    // per system call) and dispatches them to the listener
+    void DrainSocket( PacketListener *listener, UdpSocket *socket )
+    {
+        int fd = socket->impl_->Socket();
+        for( ;; ){
+            for( int i = 0; i < MAX_DATAGRAMS_PER_RECEIVE; ++i ){
+                receiveIovecs_[i].iov_base = &receiveData_[ i * MAX_BUFFER_SIZE ];
+                receiveIovecs_[i].iov_len = MAX_BUFFER_SIZE;
+                std::memset( &receiveMessages_[i], 0, sizeof(receiveMessages_[i]) );
+                receiveMessages_[i].msg_hdr.msg_iov = &receiveIovecs_[i];
+                receiveMessages_[i].msg_hdr.msg_iovlen = 1;
+                receiveMessages_[i].msg_hdr.msg_name = &receiveAddrs_[i];
+                receiveMessages_[i].msg_hdr.msg_namelen = sizeof(receiveAddrs_[i]);
+            }
+
+            int received = recvmmsg( fd, &receiveMessages_[0], MAX_DATAGRAMS_PER_RECEIVE, MSG_DONTWAIT, 0 );
+            if( received < 0 ){
+                if( errno == EINTR )
+                    continue;
+                // EAGAIN: nothing else queued. other errors are ignored, as recvfrom() errors are
+                return;
+            }
+
+            IpEndpointName remoteEndpoint;
+            for( int i = 0; i < received; ++i ){
+                std::size_t size = receiveMessages_[i].msg_len;
+                if( size > 0 ){
+                    remoteEndpoint.address = ntohl( receiveAddrs_[i].sin_addr.s_addr );
+                    remoteEndpoint.port = ntohs( receiveAddrs_[i].sin_port );
+                    listener->ProcessPacket( &receiveData_[ i * MAX_BUFFER_SIZE ], (int)size, remoteEndpoint );
+                    if( break_ )
+                        return;
+                }
+            }
+
+            if( received < MAX_DATAGRAMS_PER_RECEIVE )
+                return;
+        }
+    }
+
+    void RunEpoll()
+	{
+		break_ = false;
+
+        int epollFd = epoll_create1( EPOLL_CLOEXEC );
+        if( epollFd < 0 )
+            throw std::runtime_error("epoll_create1 failed\n");
+
+        try{
+            // in addition to listening to the inbound sockets we
+            // also listen to the asynchronous break pipe, so that AsynchronousBreak()
+            // can break us out of epoll_wait() from another thread.
+            // the event data is the index in socketListeners_ plus one, 0 being the break pipe
+            struct epoll_event event;
+            std::memset( &event, 0, sizeof(event) );
+            event.events = EPOLLIN;
+            event.data.u32 = 0;
+            if( epoll_ctl( epollFd, EPOLL_CTL_ADD, breakPipe_[0], &event ) < 0 )
+                throw std::runtime_error("epoll_ctl failed\n");
+
+            for( std::size_t i = 0; i < socketListeners_.size(); ++i ){
+                event.data.u32 = (uint32_t)(i + 1);
+                if( epoll_ctl( epollFd, EPOLL_CTL_ADD, socketListeners_[i].second->impl_->Socket(), &event ) < 0 )
+                    throw std::runtime_error("epoll_ctl failed\n");
+            }
+
+            // configure the timer queue
+            double currentTimeMs = GetCurrentTimeMs();
+
+            // expiry time ms, listener
+            std::vector< std::pair< double, AttachedTimerListener > > timerQueue_;
+            for( std::vector< AttachedTimerListener >::iterator i = timerListeners_.begin();
+                    i != timerListeners_.end(); ++i )
+                timerQueue_.push_back( std::make_pair( currentTimeMs + i->initialDelayMs, *i ) );
+            std::sort( timerQueue_.begin(), timerQueue_.end(), CompareScheduledTimerCalls );
+
+            const int MAX_EVENTS = 16;
+            struct epoll_event events[ MAX_EVENTS ];
+
+            while( !break_ ){
+                int timeoutMs = -1;
+                if( !timerQueue_.empty() ){
+                    double remainingMs = timerQueue_.front().first - GetCurrentTimeMs();
+                    timeoutMs = ( remainingMs < 0 ) ? 0 : (int)ceil( remainingMs );
+                }
+
+                int nEvents = epoll_wait( epollFd, events, MAX_EVENTS, timeoutMs );
+                if( nEvents < 0 ){
+                    if( break_ ){
+                        break;
+                    }else if( errno == EINTR ){
+                        continue;
+                    }else{
+                        throw std::runtime_error("epoll_wait failed\n");
+                    }
+                }
+
+                for( int i = 0; i < nEvents && !break_; ++i ){
+                    if( events[i].data.u32 == 0 ){
+                        // clear pending data from the asynchronous break pipe
+                        char c;
+                        read( breakPipe_[0], &c, 1 );
+                    }else{
+                        std::pair< PacketListener*, UdpSocket* >& socketListener = socketListeners_[ events[i].data.u32 - 1 ];
+                        DrainSocket( socketListener.first, socketListener.second );
+                    }
+                }
+
+                if( break_ )
+                    break;
+
+                // execute any expired timers
+                currentTimeMs = GetCurrentTimeMs();
+                bool resort = false;
+                for( std::vector< std::pair< double, AttachedTimerListener > >::iterator i = timerQueue_.begin();
+                        i != timerQueue_.end() && i->first <= currentTimeMs; ++i ){
+
+                    i->second.listener->TimerExpired();
+                    if( break_ )
+                        break;
+
+                    i->first += i->second.periodMs;
+                    resort = true;
+                }
+                if( resort )
+                    std::sort( timerQueue_.begin(), timerQueue_.end(), CompareScheduledTimerCalls );
+            }
+
+            close( epollFd );
+        }catch(...){
+            close( epollFd );
+            throw;
+        }
+	}
+#else
+    void RunSelect()
 	{
 		break_ = false;
         char *data = 0;
@@ -523,6 +735,7 @@ public:
             throw;
         }
 	}
+#endif
 
     void Break()
 	{
@@ -533,7 +746,7 @@ public:
 	{
 		break_ = true;
 
-		// Send a termination message to the asynchronous break pipe, so select() will return
+		// Send a termination message to the asynchronous break pipe, so select() / epoll_wait() will return
 		write( breakPipe_[1], "!", 1 );
 	}
 };
@@ -199,6 +199,15 @@ public:
         send( socket_, data, (int)size, 0 );
 	}
 
+	int SendMultiple( const char * const *data, const std::size_t *sizes, int count )
+	{
+		assert( isConnected_ );
+
+		for( int i = 0; i < count; ++i )
+			send( socket_, data[i], (int)sizes[i], 0 );
+		return count;
+	}
+
     void SendTo( const IpEndpointName& remoteEndpoint, const char *data, std::size_t size )
 	{
 		sendToAddr_.sin_addr.s_addr = htonl( remoteEndpoint.address );
@@ -277,6 +286,11 @@ void UdpSocket::Send( const char *data, std::size_t size )
 	impl_->Send( data, size );
 }
 
+int UdpSocket::SendMultiple( const char * const *data, const std::size_t *sizes, int count )
+{
+	return impl_->SendMultiple( data, sizes, count );
+}
+
 void UdpSocket::SendTo( const IpEndpointName& remoteEndpoint, const char *data, std::size_t size )
 {
 	impl_->SendTo( remoteEndpoint, data, size );
@@ -0,0 +1,227 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <alsa/asoundlib.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+#include "alsadevicewatcher.h"
+
+using namespace std;
+
+AlsaDeviceWatcher::AlsaDeviceWatcher(const string& clientName, bool forInput)
+    : m_seq(nullptr),
+      m_clientId(-1),
+      m_forInput(forInput)
+{
+    m_breakPipe[0] = m_breakPipe[1] = -1;
+
+    if (snd_seq_open(&m_seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0) {
+        OSMID_LOG_WARN(m_logger, "Could not open the ALSA sequencer to watch for MIDI devices");
+        m_seq = nullptr;
+        return;
+    }
+    snd_seq_set_client_name(m_seq, clientName.c_str());
+    m_clientId = snd_seq_client_id(m_seq);
+    int portId = snd_seq_create_simple_port(m_seq, "announce", SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT, SND_SEQ_PORT_TYPE_APPLICATION);
+    if (portId < 0 || snd_seq_connect_from(m_seq, portId, SND_SEQ_CLIENT_SYSTEM, SND_SEQ_PORT_SYSTEM_ANNOUNCE) < 0 || pipe(m_breakPipe) != 0) {
+        OSMID_LOG_WARN(m_logger, "Could not subscribe to the ALSA sequencer announcements");
+        snd_seq_close(m_seq);
+        m_seq = nullptr;
+        return;
+    }
+
+    // Take note of the ports that are already there
+    snd_seq_client_info_t* clientInfo;
+    snd_seq_port_info_t* portInfo;
+    snd_seq_client_info_alloca(&clientInfo);
+    snd_seq_port_info_alloca(&portInfo);
+    snd_seq_client_info_set_client(clientInfo, -1);
+    while (snd_seq_query_next_client(m_seq, clientInfo) == 0) {
+        int client = snd_seq_client_info_get_client(clientInfo);
+        snd_seq_port_info_set_client(portInfo, client);
+        snd_seq_port_info_set_port(portInfo, -1);
+        while (snd_seq_query_next_port(m_seq, portInfo) == 0) {
+            addPort(client, snd_seq_port_info_get_port(portInfo));
+        }
+    }
+}
+
+AlsaDeviceWatcher::~AlsaDeviceWatcher()
+{
+    if (m_seq == nullptr)
+        return;
+    close(m_breakPipe[0]);
+    close(m_breakPipe[1]);
+    snd_seq_close(m_seq);
+}
+
+void AlsaDeviceWatcher::interrupt()
+{
+    char c = 0;
+    // Nothing useful to do if it fails, waitForChanges will time out anyway
+    if (write(m_breakPipe[1], &c, 1) != 1)
+        return;
+}
+
+bool AlsaDeviceWatcher::waitForChanges(int timeoutMs, vector<string>& removedPorts)
+{
+    int nSeqFds = snd_seq_poll_descriptors_count(m_seq, POLLIN);
+    vector<struct pollfd> fds(nSeqFds + 1);
+    fds[0].fd = m_breakPipe[0];
+    fds[0].events = POLLIN;
+    snd_seq_poll_descriptors(m_seq, &fds[1], nSeqFds, POLLIN);
+
+    int rc = poll(fds.data(), static_cast<nfds_t>(fds.size()), timeoutMs);
+    if (rc <= 0)
+        return false;
+    if (fds[0].revents & POLLIN) {
+        char c;
+        if (read(m_breakPipe[0], &c, 1) == 1)
+            return false;
+    }
+
+    auto oldNames = getDeviceNames();
+    bool changed = false;
+    snd_seq_event_t* ev;
+    int err;
+    while ((err = snd_seq_event_input(m_seq, &ev)) >= 0 || err == -ENOSPC) {
+        if (err == -ENOSPC || ev == nullptr)
+            continue;
+        const snd_seq_addr_t& addr = ev->data.addr;
+        if (addr.client == m_clientId)
+            continue;
+
+        switch (ev->type) {
+        case SND_SEQ_EVENT_PORT_START:
+            changed |= addPort(addr.client, addr.port);
+            break;
+        case SND_SEQ_EVENT_PORT_EXIT:
+            changed |= removePort(addr.client, addr.port);
+            break;
+        case SND_SEQ_EVENT_PORT_CHANGE:
+            changed |= renamePort(addr.client, addr.port);
+            break;
+        case SND_SEQ_EVENT_CLIENT_EXIT:
+            changed |= removeClient(addr.client);
+            break;
+        default:
+            break;
+        }
+    }
+    if (!changed)
+        return false;
+
+    // Removing or renaming a port can renumber the other ports with the same name, so the devices
+    // that were open with their old numbered names have to be reopened as well
+    auto newNames = getDeviceNames();
+    for (const auto& oldName : oldNames) {
+        auto found = newNames.find(oldName.first);
+        if (found == newNames.end() || found->second != oldName.second) {
+            removedPorts.push_back(oldName.second);
+        }
+    }
+    return true;
+}
+
+bool AlsaDeviceWatcher::addPort(int client, int port)
+{
+    snd_seq_port_info_t* portInfo;
+    snd_seq_port_info_alloca(&portInfo);
+    if (snd_seq_get_any_port_info(m_seq, client, port, portInfo) < 0)
+        return false;
+    // Ports that nobody can subscribe to are not MIDI devices (i.e. the private ports of m2o and o2m)
+    if ((snd_seq_port_info_get_capability(portInfo) & (SND_SEQ_PORT_CAP_SUBS_READ | SND_SEQ_PORT_CAP_SUBS_WRITE)) == 0)
+        return false;
+    m_ports[portKey(client, port)] = PortInfo{ snd_seq_port_info_get_name(portInfo), snd_seq_port_info_get_capability(portInfo) };
+    return true;
+}
+
+// Port changes are only interesting if the name changed, otherwise the device would be reopened for nothing
+bool AlsaDeviceWatcher::renamePort(int client, int port)
+{
+    auto found = m_ports.find(portKey(client, port));
+    if (found == m_ports.end())
+        return addPort(client, port);
+
+    PortInfo oldInfo = found->second;
+    m_ports.erase(found);
+    if (!addPort(client, port))
+        return true;
+    return m_ports[portKey(client, port)].name != oldInfo.name;
+}
+
+bool AlsaDeviceWatcher::removePort(int client, int port)
+{
+    return m_ports.erase(portKey(client, port)) > 0;
+}
+
+bool AlsaDeviceWatcher::removeClient(int client)
+{
+    bool removed = false;
+    for (auto it = m_ports.begin(); it != m_ports.end();) {
+        if ((it->first >> 8) == client) {
+            it = m_ports.erase(it);
+            removed = true;
+        } else {
+            ++it;
+        }
+    }
+    return removed;
+}
+
+// Does what JUCE's getDevices() does: same ports (JUCE's inputs are the ports with SUBS_WRITE, and its outputs
+// the ones with SUBS_READ), in the same order, and duplicate names (ignoring case) all numbered " (1)", " (2)"...
+// JUCE also skips its own client, where the only subscribable ports are our virtual ones, which are not opened as devices
+map<int, string> AlsaDeviceWatcher::getDeviceNames() const
+{
+    const unsigned int wanted = (m_forInput ? SND_SEQ_PORT_CAP_SUBS_WRITE : SND_SEQ_PORT_CAP_SUBS_READ);
+    vector<pair<int, string> > devices;
+    for (const auto& port : m_ports) {
+        if ((port.first >> 8) != SND_SEQ_CLIENT_SYSTEM && (port.second.capability & wanted) != 0) {
+            devices.emplace_back(port.first, port.second.name);
+        }
+    }
+
+    auto lowerCase = [](string name) {
+        for (auto& c : name) {
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+        return name;
+    };
+    map<string, int> duplicates;
+    for (const auto& device : devices) {
+        duplicates[lowerCase(device.second)]++;
+    }
+    map<string, int> numbers;
+    map<int, string> names;
+    for (const auto& device : devices) {
+        string key = lowerCase(device.second);
+        if (duplicates[key] > 1) {
+            names[device.first] = device.second + " (" + to_string(++numbers[key]) + ")";
+        } else {
+            names[device.first] = device.second;
+        }
+    }
+    return names;
+}
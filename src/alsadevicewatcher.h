@@ -0,0 +1,74 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include "monitorlogger.h"
+
+struct _snd_seq;
+
+// Watches the ALSA System:Announce port, to find out when MIDI ports come and go (Linux only).
+// Nothing runs while there are no changes, the caller just blocks in waitForChanges()
+class AlsaDeviceWatcher {
+public:
+    // forInput tells which of JUCE's device lists (MIDI inputs or outputs) the removed port names refer to
+    AlsaDeviceWatcher(const std::string& clientName, bool forInput);
+    AlsaDeviceWatcher(const AlsaDeviceWatcher&) = delete;
+    AlsaDeviceWatcher& operator=(const AlsaDeviceWatcher&) = delete;
+    ~AlsaDeviceWatcher();
+
+    bool isValid() const { return m_seq != nullptr; }
+
+    // Waits up to timeoutMs (-1: no limit) for ports to be added or removed. Returns true if they were,
+    // with the names of the removed ports added to removedPorts. The names are the ones JUCE gives the devices,
+    // so a port whose " (n)" duplicate number changed is reported as removed too.
+    // Returns false on timeout or interrupt()
+    bool waitForChanges(int timeoutMs, std::vector<std::string>& removedPorts);
+
+    // Makes waitForChanges() return. Safe to call from a signal handler
+    void interrupt();
+
+private:
+    struct PortInfo {
+        std::string name;
+        unsigned int capability;
+    };
+
+    static int portKey(int client, int port) { return (client << 8) | port; }
+    bool addPort(int client, int port);
+    bool renamePort(int client, int port);
+    bool removePort(int client, int port);
+    bool removeClient(int client);
+    // The name of every port in JUCE's device list, by port key
+    std::map<int, std::string> getDeviceNames() const;
+
+    _snd_seq* m_seq;
+    int m_clientId;
+    bool m_forInput;
+    int m_breakPipe[2];
+    // Every subscribable port, so we can tell which device is gone when a port exit is announced.
+    // Ordered like the ports are listed by JUCE, to number the duplicate names the same way
+    std::map<int, PortInfo> m_ports;
+    MonitorLogger& m_logger{ MonitorLogger::getInstance() };
+};
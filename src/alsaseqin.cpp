@@ -0,0 +1,394 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <alsa/asoundlib.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include "alsaseqin.h"
+#include "midistatus.h"
+#include "realtime.h"
+
+using namespace std;
+
+atomic<unsigned int> AlsaSeqIn::m_currentSourcesGeneration(1);
+int AlsaSeqIn::m_nClients = 1;
+vector<shared_ptr<AlsaSeqIn> > AlsaSeqIn::m_clients;
+mutex AlsaSeqIn::m_clientsMutex;
+
+AlsaSeqIn::AlsaSeqIn(const string& clientName)
+    : m_seq(nullptr),
+      m_clientId(-1),
+      m_portId(-1),
+      m_decoder(nullptr),
+      m_sourcesGeneration(0)
+{
+    m_breakPipe[0] = m_breakPipe[1] = -1;
+
+    if (snd_seq_open(&m_seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0) {
+        OSMID_LOG_WARN(m_logger, "Could not open the ALSA sequencer for MIDI input");
+        m_seq = nullptr;
+        return;
+    }
+    snd_seq_set_client_name(m_seq, clientName.c_str());
+    m_clientId = snd_seq_client_id(m_seq);
+    // Not subscribable: we connect to the sources ourselves, and don't want to appear as a device
+    m_portId = snd_seq_create_simple_port(m_seq, "input", SND_SEQ_PORT_CAP_WRITE, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    if (m_portId < 0 || snd_midi_event_new(1024, &m_decoder) < 0 || pipe(m_breakPipe) != 0) {
+        OSMID_LOG_WARN(m_logger, "Could not set up the ALSA sequencer for MIDI input");
+        if (m_decoder != nullptr)
+            snd_midi_event_free(m_decoder);
+        m_decoder = nullptr;
+        snd_seq_close(m_seq);
+        m_seq = nullptr;
+        return;
+    }
+    // Every decoded message gets its own status byte
+    snd_midi_event_no_status(m_decoder, 1);
+
+    m_thread = thread(&AlsaSeqIn::inputThread, this);
+}
+
+AlsaSeqIn::~AlsaSeqIn()
+{
+    if (m_seq == nullptr)
+        return;
+
+    char c = 0;
+    if (write(m_breakPipe[1], &c, 1) != 1) {
+        OSMID_LOG_ERROR(m_logger, "Could not stop the ALSA sequencer input thread");
+    }
+    m_thread.join();
+    close(m_breakPipe[0]);
+    close(m_breakPipe[1]);
+    snd_midi_event_free(m_decoder);
+    snd_seq_close(m_seq);
+}
+
+void AlsaSeqIn::setNumClients(int nClients)
+{
+    lock_guard<mutex> lock(m_clientsMutex);
+    m_nClients = max(nClients, 1);
+}
+
+shared_ptr<AlsaSeqIn> AlsaSeqIn::getInstance()
+{
+    lock_guard<mutex> lock(m_clientsMutex);
+    if (m_clients.empty()) {
+        for (int i = 0; i < m_nClients; i++) {
+            auto seqIn = make_shared<AlsaSeqIn>(i == 0 ? string("m2o") : "m2o-" + to_string(i + 1));
+            if (!seqIn->isValid())
+                break;
+            m_clients.push_back(seqIn);
+        }
+        if (m_clients.empty())
+            return nullptr;
+    }
+
+    // Inputs are subscribed as soon as they are opened, so this spreads them evenly, also when hotplugging
+    return *min_element(m_clients.begin(), m_clients.end(), [](const shared_ptr<AlsaSeqIn>& a, const shared_ptr<AlsaSeqIn>& b) {
+        return a->getNumInputs() < b->getNumInputs();
+    });
+}
+
+void AlsaSeqIn::invalidateSources()
+{
+    m_currentSourcesGeneration++;
+}
+
+bool AlsaSeqIn::findSource(const string& portName, int& client, int& port)
+{
+    lock_guard<mutex> lock(m_sourcesMutex);
+    unsigned int generation = m_currentSourcesGeneration;
+    if (m_sourcesGeneration != generation) {
+        scanSources();
+        m_sourcesGeneration = generation;
+    }
+
+    auto search = m_sources.find(portName);
+    // JUCE tells devices with the same name apart by their order, leave those to it
+    if (search == m_sources.end() || search->second < 0)
+        return false;
+
+    client = search->second >> 8;
+    port = search->second & 0xff;
+    return true;
+}
+
+void AlsaSeqIn::scanSources()
+{
+    snd_seq_client_info_t* clientInfo;
+    snd_seq_port_info_t* portInfo;
+    snd_seq_client_info_alloca(&clientInfo);
+    snd_seq_port_info_alloca(&portInfo);
+
+    m_sources.clear();
+    snd_seq_client_info_set_client(clientInfo, -1);
+    while (snd_seq_query_next_client(m_seq, clientInfo) == 0) {
+        int clientId = snd_seq_client_info_get_client(clientInfo);
+        if (clientId == m_clientId || clientId == SND_SEQ_CLIENT_SYSTEM)
+            continue;
+
+        snd_seq_port_info_set_client(portInfo, clientId);
+        snd_seq_port_info_set_port(portInfo, -1);
+        while (snd_seq_query_next_port(m_seq, portInfo) == 0) {
+            const unsigned int caps = SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+            if ((snd_seq_port_info_get_capability(portInfo) & caps) != caps)
+                continue;
+            auto inserted = m_sources.emplace(snd_seq_port_info_get_name(portInfo), sourceKey(clientId, snd_seq_port_info_get_port(portInfo)));
+            if (!inserted.second)
+                inserted.first->second = -1;
+        }
+    }
+}
+
+bool AlsaSeqIn::subscribe(int client, int port, NativeMidiInputCallback* callback)
+{
+    lock_guard<mutex> lock(m_subscribeMutex);
+    auto subscriptions = make_unique<Subscriptions>(*m_subscriptions.read());
+    (*subscriptions)[sourceKey(client, port)] = callback;
+    m_subscriptions.publish(std::move(subscriptions));
+
+    int err = snd_seq_connect_from(m_seq, m_portId, client, port);
+    if (err < 0) {
+        OSMID_LOG_ERROR(m_logger, "Could not connect to ALSA sequencer port {}:{}: {}", client, port, snd_strerror(err));
+        return false;
+    }
+    return true;
+}
+
+void AlsaSeqIn::unsubscribe(int client, int port)
+{
+    lock_guard<mutex> lock(m_subscribeMutex);
+    snd_seq_disconnect_from(m_seq, m_portId, client, port);
+    auto subscriptions = make_unique<Subscriptions>(*m_subscriptions.read());
+    subscriptions->erase(sourceKey(client, port));
+    // Waits for the input thread to be done with the old snapshot
+    m_subscriptions.publish(std::move(subscriptions));
+}
+
+void AlsaSeqIn::inputThread()
+{
+    realtime::setupCurrentThread("ALSA MIDI input");
+    int nSeqFds = snd_seq_poll_descriptors_count(m_seq, POLLIN);
+    vector<struct pollfd> fds(nSeqFds + 1);
+    fds[0].fd = m_breakPipe[0];
+    fds[0].events = POLLIN;
+    snd_seq_poll_descriptors(m_seq, &fds[1], nSeqFds, POLLIN);
+
+    while (true) {
+        if (poll(fds.data(), static_cast<nfds_t>(fds.size()), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            OSMID_LOG_ERROR(m_logger, "Error polling the ALSA sequencer: {}", strerror(errno));
+            return;
+        }
+        if (fds[0].revents & POLLIN)
+            return;
+
+        // Read everything that is pending before going back to poll
+        snd_seq_event_t* ev;
+        int err;
+        while ((err = snd_seq_event_input(m_seq, &ev)) >= 0 || err == -ENOSPC) {
+            if (err == -ENOSPC) {
+                OSMID_LOG_WARN(m_logger, "ALSA sequencer input overrun, some MIDI events were lost");
+                continue;
+            }
+            if (ev != nullptr) {
+                handleEvent(ev);
+            }
+        }
+
+        auto subscriptions = m_subscriptions.read();
+        for (auto& subscription : *subscriptions) {
+            subscription.second->handleEndOfBurst();
+        }
+    }
+}
+
+void AlsaSeqIn::handleEvent(const snd_seq_event_t* ev)
+{
+    // The callback can't go away while we hold on to the snapshot
+    auto subscriptions = m_subscriptions.read();
+    int key = sourceKey(ev->source.client, ev->source.port);
+    auto found = subscriptions->find(key);
+    if (found == subscriptions->end())
+        return;
+    Subscription subscription{ found->second, key };
+
+    uint8_t message[3];
+    const uint8_t channel = ev->data.note.channel & 0x0f;
+    switch (ev->type) {
+    case SND_SEQ_EVENT_NOTEON:
+        message[0] = 0x90 | channel;
+        message[1] = ev->data.note.note & 0x7f;
+        message[2] = ev->data.note.velocity & 0x7f;
+        deliver(subscription, message, 3);
+        break;
+    case SND_SEQ_EVENT_NOTEOFF:
+        message[0] = 0x80 | channel;
+        message[1] = ev->data.note.note & 0x7f;
+        message[2] = ev->data.note.velocity & 0x7f;
+        deliver(subscription, message, 3);
+        break;
+    case SND_SEQ_EVENT_KEYPRESS:
+        message[0] = 0xa0 | channel;
+        message[1] = ev->data.note.note & 0x7f;
+        message[2] = ev->data.note.velocity & 0x7f;
+        deliver(subscription, message, 3);
+        break;
+    case SND_SEQ_EVENT_CONTROLLER:
+        message[0] = 0xb0 | channel;
+        message[1] = ev->data.control.param & 0x7f;
+        message[2] = ev->data.control.value & 0x7f;
+        deliver(subscription, message, 3);
+        break;
+    case SND_SEQ_EVENT_PGMCHANGE:
+        message[0] = 0xc0 | channel;
+        message[1] = ev->data.control.value & 0x7f;
+        deliver(subscription, message, 2);
+        break;
+    case SND_SEQ_EVENT_CHANPRESS:
+        message[0] = 0xd0 | channel;
+        message[1] = ev->data.control.value & 0x7f;
+        deliver(subscription, message, 2);
+        break;
+    case SND_SEQ_EVENT_PITCHBEND: {
+        // ALSA gives it centered on 0
+        int value = ev->data.control.value + 8192;
+        message[0] = 0xe0 | channel;
+        message[1] = value & 0x7f;
+        message[2] = (value >> 7) & 0x7f;
+        deliver(subscription, message, 3);
+        break;
+    }
+    case SND_SEQ_EVENT_QFRAME:
+        message[0] = 0xf1;
+        message[1] = ev->data.control.value & 0x7f;
+        deliver(subscription, message, 2);
+        break;
+    case SND_SEQ_EVENT_SONGPOS:
+        message[0] = 0xf2;
+        message[1] = ev->data.control.value & 0x7f;
+        message[2] = (ev->data.control.value >> 7) & 0x7f;
+        deliver(subscription, message, 3);
+        break;
+    case SND_SEQ_EVENT_SONGSEL:
+        message[0] = 0xf3;
+        message[1] = ev->data.control.value & 0x7f;
+        deliver(subscription, message, 2);
+        break;
+    case SND_SEQ_EVENT_TUNE_REQUEST:
+        message[0] = 0xf6;
+        deliver(subscription, message, 1);
+        break;
+    case SND_SEQ_EVENT_CLOCK:
+        message[0] = 0xf8;
+        deliver(subscription, message, 1);
+        break;
+    case SND_SEQ_EVENT_START:
+        message[0] = 0xfa;
+        deliver(subscription, message, 1);
+        break;
+    case SND_SEQ_EVENT_CONTINUE:
+        message[0] = 0xfb;
+        deliver(subscription, message, 1);
+        break;
+    case SND_SEQ_EVENT_STOP:
+        message[0] = 0xfc;
+        deliver(subscription, message, 1);
+        break;
+    case SND_SEQ_EVENT_SENSING:
+        message[0] = 0xfe;
+        deliver(subscription, message, 1);
+        break;
+    case SND_SEQ_EVENT_RESET:
+        message[0] = 0xff;
+        deliver(subscription, message, 1);
+        break;
+    case SND_SEQ_EVENT_SYSEX:
+        handleSysex(subscription, static_cast<const uint8_t*>(ev->data.ext.ptr), static_cast<int>(ev->data.ext.len));
+        break;
+    default: {
+        // Anything else (14 bit controllers, (N)RPNs, ...) goes through the ALSA decoder
+        uint8_t buffer[32];
+        long nBytes = snd_midi_event_decode(m_decoder, buffer, sizeof(buffer), ev);
+        snd_midi_event_reset_decode(m_decoder);
+        if (nBytes > 0)
+            handleDecodedBytes(subscription, buffer, static_cast<int>(nBytes));
+        break;
+    }
+    }
+}
+
+void AlsaSeqIn::handleSysex(Subscription& subscription, const uint8_t* data, int size)
+{
+    if (size <= 0)
+        return;
+    // sysex may arrive in several chunks
+    vector<uint8_t>& sysex = m_sysexBuffers[subscription.key];
+
+    // Complete sysex in a single event, the usual case
+    if (sysex.empty() && data[0] == 0xf0 && data[size - 1] == 0xf7) {
+        deliver(subscription, data, size);
+        return;
+    }
+
+    if (data[0] == 0xf0) {
+        // A new sysex, anything left over from an unfinished one is dropped
+        sysex.clear();
+    } else if (sysex.empty()) {
+        OSMID_LOG_WARN(m_logger, "Dropping sysex continuation without a start");
+        return;
+    }
+    sysex.insert(sysex.end(), data, data + size);
+    if (sysex.back() == 0xf7) {
+        deliver(subscription, sysex.data(), static_cast<int>(sysex.size()));
+        sysex.clear();
+    }
+}
+
+// The decoder may produce several messages for one event, like the 2 controllers of a 14 bit controller
+void AlsaSeqIn::handleDecodedBytes(Subscription& subscription, const uint8_t* data, int size)
+{
+    int pos = 0;
+    while (pos < size) {
+        int statusSlot = midi_status::getStatusSlot(data[pos]);
+        int length = midi_status::getStatusInfo(statusSlot).expectedLength;
+        if (length == 0 || pos + length > size)
+            length = size - pos;
+        deliver(subscription, data + pos, length);
+        pos += length;
+    }
+}
+
+void AlsaSeqIn::deliver(Subscription& subscription, const uint8_t* message, int nBytes)
+{
+    uint8_t status = message[0];
+    unsigned char channel = 0xff;
+    if (status >= 0x80 && status < 0xf0) {
+        channel = (status & 0x0f) + 1;
+        status &= 0xf0;
+    }
+    subscription.callback->handleIncomingMidiBytes(midi_status::getStatusSlot(status), channel, message, nBytes);
+}
@@ -0,0 +1,106 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "midiin.h"
+#include "monitorlogger.h"
+#include "rcu.h"
+
+struct _snd_seq;
+struct _snd_midi_event;
+struct snd_seq_event;
+
+// Reads MIDI input straight from the ALSA sequencer (Linux only).
+// Sequencer events are mapped to MIDI bytes with their status slot and channel already known,
+// instead of going through JUCE's decode to bytes, concatenate and parse again
+class AlsaSeqIn {
+public:
+    explicit AlsaSeqIn(const std::string& clientName);
+    AlsaSeqIn(const AlsaSeqIn&) = delete;
+    AlsaSeqIn& operator=(const AlsaSeqIn&) = delete;
+    ~AlsaSeqIn();
+
+    // The m2o inputs are spread over this many sequencer clients, each read by its own thread,
+    // so that many busy devices are not all handled on one core. Set it before the first getInstance()
+    static void setNumClients(int nClients);
+    // The shared sequencer client with the fewest inputs, for a new one. nullptr if the sequencer could not be opened
+    static std::shared_ptr<AlsaSeqIn> getInstance();
+    int getNumInputs() const { return static_cast<int>(m_subscriptions.read()->size()); }
+
+    bool isValid() const { return m_seq != nullptr; }
+
+    // Finds the readable sequencer port with this name. Fails if there is none, or more than one
+    // The ports are listed once, and again after invalidateSources()
+    bool findSource(const std::string& portName, int& client, int& port);
+    // Called when the MIDI devices are rescanned, so the next findSource sees the new ports
+    static void invalidateSources();
+
+    bool subscribe(int client, int port, NativeMidiInputCallback* callback);
+    // Once this returns, the callback is not running and won't be called again
+    void unsubscribe(int client, int port);
+
+private:
+    typedef std::unordered_map<int, NativeMidiInputCallback*> Subscriptions;
+    struct Subscription {
+        NativeMidiInputCallback* callback;
+        int key;
+    };
+
+    static int sourceKey(int client, int port) { return (client << 8) | port; }
+
+    void scanSources();
+    void inputThread();
+    void handleEvent(const snd_seq_event* ev);
+    void handleSysex(Subscription& subscription, const uint8_t* data, int size);
+    void handleDecodedBytes(Subscription& subscription, const uint8_t* data, int size);
+    void deliver(Subscription& subscription, const uint8_t* message, int nBytes);
+
+    _snd_seq* m_seq;
+    int m_clientId;
+    int m_portId;
+    _snd_midi_event* m_decoder; // only for the less common events, like 14 bit controllers and (N)RPNs
+    // Published as a snapshot, so the input thread looks callbacks up without locking,
+    // and unsubscribe can wait for the callbacks that may still be running
+    RcuSnapshot<Subscriptions> m_subscriptions;
+    std::mutex m_subscribeMutex;
+    // Source key by port name, -1 for names used by more than one port
+    std::unordered_map<std::string, int> m_sources;
+    std::mutex m_sourcesMutex;
+    unsigned int m_sourcesGeneration;
+    static std::atomic<unsigned int> m_currentSourcesGeneration;
+    static int m_nClients;
+    static std::vector<std::shared_ptr<AlsaSeqIn> > m_clients;
+    static std::mutex m_clientsMutex;
+    // Partial sysex per source, only touched by the input thread
+    std::unordered_map<int, std::vector<uint8_t> > m_sysexBuffers;
+    int m_breakPipe[2];
+    std::thread m_thread;
+    MonitorLogger& m_logger{ MonitorLogger::getInstance() };
+};
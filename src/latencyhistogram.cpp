@@ -0,0 +1,106 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "latencyhistogram.h"
+
+using namespace std;
+
+LatencyHistogram::LatencyHistogram()
+    : m_max(0)
+{
+    for (auto& bucket : m_buckets) {
+        bucket.store(0, memory_order_relaxed);
+    }
+}
+
+int LatencyHistogram::bucketIndex(uint64_t nanoseconds)
+{
+    if (nanoseconds < N_SUB_BUCKETS) {
+        return static_cast<int>(nanoseconds);
+    }
+#ifdef _MSC_VER
+    unsigned long exponent;
+    _BitScanReverse64(&exponent, nanoseconds);
+#else
+    int exponent = 63 - __builtin_clzll(nanoseconds);
+#endif
+    // The top SUB_BUCKET_BITS bits under the leading one pick the linear bucket
+    int shift = static_cast<int>(exponent) - SUB_BUCKET_BITS;
+    int index = (shift + 1) * N_SUB_BUCKETS + static_cast<int>((nanoseconds >> shift) & (N_SUB_BUCKETS - 1));
+    return min(index, N_BUCKETS - 1);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(int index)
+{
+    if (index < N_SUB_BUCKETS) {
+        return static_cast<uint64_t>(index);
+    }
+    int shift = index / N_SUB_BUCKETS - 1;
+    uint64_t subBucket = static_cast<uint64_t>(N_SUB_BUCKETS + index % N_SUB_BUCKETS);
+    return ((subBucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(chrono::nanoseconds latency)
+{
+    uint64_t nanoseconds = static_cast<uint64_t>(max<chrono::nanoseconds::rep>(latency.count(), 0));
+    m_buckets[bucketIndex(nanoseconds)].fetch_add(1, memory_order_relaxed);
+
+    uint64_t currentMax = m_max.load(memory_order_relaxed);
+    while (nanoseconds > currentMax && !m_max.compare_exchange_weak(currentMax, nanoseconds, memory_order_relaxed)) {
+    }
+}
+
+LatencySummary LatencyHistogram::takeSummary()
+{
+    // Emptying the buckets one by one can split a concurrent record between two summaries, that's fine for stats
+    uint64_t counts[N_BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < N_BUCKETS; i++) {
+        counts[i] = m_buckets[i].exchange(0, memory_order_relaxed);
+        total += counts[i];
+    }
+    uint64_t maxNanoseconds = m_max.exchange(0, memory_order_relaxed);
+
+    LatencySummary summary = { total, 0.0f, 0.0f, 0.0f, maxNanoseconds / 1000.0f };
+    if (total == 0) {
+        return summary;
+    }
+
+    float* percentiles[] = { &summary.p50, &summary.p99, &summary.p999 };
+    const double fractions[] = { 0.5, 0.99, 0.999 };
+    uint64_t seen = 0;
+    int nextPercentile = 0;
+    for (int i = 0; i < N_BUCKETS && nextPercentile < 3; i++) {
+        seen += counts[i];
+        while (nextPercentile < 3 && seen >= static_cast<uint64_t>(fractions[nextPercentile] * total + 0.5)) {
+            // The top of the bucket, but never above what was actually seen. The last bucket has no top
+            uint64_t upper = (i == N_BUCKETS - 1 ? maxNanoseconds : min(bucketUpperBound(i), maxNanoseconds));
+            *percentiles[nextPercentile] = upper / 1000.0f;
+            nextPercentile++;
+        }
+    }
+    return summary;
+}
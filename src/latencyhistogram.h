@@ -0,0 +1,61 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// What a LatencyHistogram reports, in microseconds
+struct LatencySummary {
+    uint64_t count;
+    float p50;
+    float p99;
+    float p999;
+    float max;
+};
+
+// Lock-free log-linear histogram of latencies. Every power of two of nanoseconds is split into 8 linear buckets,
+// so the percentiles are off by at most 12.5%. Any thread can record, while another one takes the summaries
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void record(std::chrono::nanoseconds latency);
+    // Summarizes what was recorded since the previous call, and starts over
+    LatencySummary takeSummary();
+
+private:
+    static const int SUB_BUCKET_BITS = 3;
+    static const int N_SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    // Up to 2^40 ns (about 18 minutes). Anything longer goes into the last bucket
+    static const int MAX_EXPONENT = 40;
+    static const int N_BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * N_SUB_BUCKETS;
+
+    static int bucketIndex(uint64_t nanoseconds);
+    static uint64_t bucketUpperBound(int index);
+
+    std::atomic<uint64_t> m_buckets[N_BUCKETS];
+    std::atomic<uint64_t> m_max;
+};
@@ -22,6 +22,7 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <algorithm>
 #include "cxxopts.hpp"
 #include "midiin.h"
 #include "oscout.h"
@@ -29,6 +30,11 @@
 #include "osc/OscOutboundPacketStream.h"
 #include "version.h"
 #include "utils.h"
+#include "realtime.h"
+#if OSMID_ALSA
+#include "alsadevicewatcher.h"
+#include "alsaseqin.h"
+#endif
 
 using namespace std;
 
@@ -50,9 +56,17 @@ struct ProgramOptions {
     string oscTemplate;
     bool oscRawMidiMessage;
     bool oscHeartbeat;
+    unsigned int udpBatchDelay;
+    unsigned int oscBundleWindow;
+    unsigned int queueSize;
+    bool juceInput;
+    unsigned int seqClients;
     bool useVirtualPort;
     string virtualPortName;
     unsigned int monitor;
+    unsigned int rtPriority;
+    vector<int> cpus;
+    bool lockMemory;
     bool listPorts;
 };
 
@@ -74,6 +88,14 @@ int setup_and_parse_program_options(int argc, char* argv[], ProgramOptions& prog
     ("t,osctemplate", "OSC output template (use $n: midi port name, $i: midi port id, $c: midi channel, $m: message_type", cxxopts::value<string>(programOptions.oscTemplate))
     ("r,oscrawmidimessage", "OSC send the raw MIDI data as part of the OSC message", cxxopts::value<bool>(programOptions.oscRawMidiMessage))
     ("b,heartbeat", "OSC send the heartbeat with info about the active MIDI devices", cxxopts::value<bool>(programOptions.oscHeartbeat))
+    ("bundle", "Group the OSC messages produced within this many microseconds into one OSC bundle, timetagged with the MIDI receive time (0: disabled)", cxxopts::value<unsigned int>(programOptions.oscBundleWindow)->default_value("0"))
+    ("udpbatch", "Batch the OSC UDP packets, sending them together at the end of each MIDI burst, or at most this many microseconds after the first one (0: disabled)", cxxopts::value<unsigned int>(programOptions.udpBatchDelay)->default_value("0"))
+    ("queuesize", "Size of the queue of MIDI messages between each input and its OSC sender thread (0: encode and send the OSC on the MIDI input thread)", cxxopts::value<unsigned int>(programOptions.queueSize)->default_value("1024"))
+    ("juceinput", "Read MIDI through JUCE, instead of directly from the ALSA sequencer (Linux only)", cxxopts::value<bool>(programOptions.juceInput))
+    ("seqclients", "Spread the MIDI inputs over this many ALSA sequencer clients, each read by its own thread (Linux only)", cxxopts::value<unsigned int>(programOptions.seqClients)->default_value("1"))
+    ("rtpriority", "Run the threads that handle MIDI and OSC with SCHED_FIFO at this priority, 1-99 (0: normal scheduling)", cxxopts::value<unsigned int>(programOptions.rtPriority)->default_value("0"))
+    ("cpu", "Pin the threads that handle MIDI and OSC to this CPU - can be specified multiple times", cxxopts::value<vector<int> >(programOptions.cpus))
+    ("mlock", "Lock the process memory, so page faults don't cause latency spikes", cxxopts::value<bool>(programOptions.lockMemory))
     ("m,monitor", "Monitor and logging level (lower more verbose)", cxxopts::value<unsigned int>(programOptions.monitor)->default_value("2")->implicit_value("1"))
     ("h,help", "Display this help message")
     ("version", "Show the version number");
@@ -99,11 +121,13 @@ int setup_and_parse_program_options(int argc, char* argv[], ProgramOptions& prog
     programOptions.oscRawMidiMessage = (options.count("oscrawmidimessage") ? true : false);
     programOptions.oscHeartbeat = (options.count("heartbeat") ? true : false);
     programOptions.useVirtualPort = (options.count("virtualport") ? true : false);
+    programOptions.juceInput = (options.count("juceinput") ? true : false);
     programOptions.listPorts = (options.count("list") ? true : false);
+    programOptions.lockMemory = (options.count("mlock") ? true : false);
 
     if (!options.count("midiin")) {
         // by default add all input devices
-        programOptions.midiInputNames = MidiIn::getInputNames();
+        programOptions.midiInputNames = MidiIn::scanInputs()->names;
         programOptions.allMidiInputs = true;
     } else {
         programOptions.allMidiInputs = false;
@@ -116,18 +140,24 @@ int setup_and_parse_program_options(int argc, char* argv[], ProgramOptions& prog
     return 0;
 }
 
-void prepareMidiProcessors(vector<unique_ptr<MidiInProcessor> >& midiInputProcessors, const ProgramOptions& popts, vector<shared_ptr<OscOutput> >& oscOutputs)
+unique_ptr<MidiInProcessor> createMidiProcessor(const string& input, const ProgramOptions& popts, vector<shared_ptr<OscOutput> >& oscOutputs, shared_ptr<OscBundler> oscBundler)
+{
+    MidiInProcessor::OscSettings oscSettings;
+    oscSettings.useOscTemplate = popts.useOscTemplate;
+    oscSettings.oscTemplate = popts.oscTemplate;
+    oscSettings.oscRawMidiMessage = popts.oscRawMidiMessage;
+    oscSettings.oscBundler = oscBundler;
+    return make_unique<MidiInProcessor>(input, oscOutputs, oscSettings, false, !popts.juceInput, popts.queueSize);
+}
+
+void prepareMidiProcessors(vector<unique_ptr<MidiInProcessor> >& midiInputProcessors, const ProgramOptions& popts, vector<shared_ptr<OscOutput> >& oscOutputs, shared_ptr<OscBundler> oscBundler)
 {
     // Should we open all devices, or just the ones passed as parameters?
     vector<string> midiInputsToOpen = (popts.allMidiInputs ? MidiIn::getInputNames() : popts.midiInputNames);
 
     for (auto& input : midiInputsToOpen) {
         try {
-            auto midiInputProcessor = make_unique<MidiInProcessor>(input, oscOutputs, false);
-            if (popts.useOscTemplate)
-                midiInputProcessor->setOscTemplate(popts.oscTemplate);
-            midiInputProcessor->setOscRawMidiMessage(popts.oscRawMidiMessage);
-            midiInputProcessors.push_back(std::move(midiInputProcessor));
+            midiInputProcessors.push_back(createMidiProcessor(input, popts, oscOutputs, oscBundler));
         } catch (const std::out_of_range&) {
             cout << "The device " << input << " does not exist";
             throw;
@@ -135,7 +165,41 @@ void prepareMidiProcessors(vector<unique_ptr<MidiInProcessor> >& midiInputProces
     }
 }
 
+// Closes the inputs that are gone (or were removed and plugged again, so need reopening), and opens the ones that appeared.
+// The rest of the inputs are left alone, so they don't miss any messages
+void updateMidiProcessors(vector<unique_ptr<MidiInProcessor> >& midiInputProcessors, const ProgramOptions& popts, vector<shared_ptr<OscOutput> >& oscOutputs, shared_ptr<OscBundler> oscBundler,
+    const vector<string>& availablePorts, const vector<string>& removedPorts)
+{
+    auto isIn = [](const vector<string>& names, const string& name) {
+        return find(names.begin(), names.end(), name) != names.end();
+    };
+
+    midiInputProcessors.erase(remove_if(midiInputProcessors.begin(), midiInputProcessors.end(), [&](const unique_ptr<MidiInProcessor>& processor) {
+        const string& name = processor->getInputPortname();
+        return isIn(removedPorts, name) || !isIn(availablePorts, name);
+    }), midiInputProcessors.end());
+
+    for (auto& input : availablePorts) {
+        if (!popts.allMidiInputs && !isIn(popts.midiInputNames, input))
+            continue;
+        bool alreadyOpen = any_of(midiInputProcessors.begin(), midiInputProcessors.end(), [&](const unique_ptr<MidiInProcessor>& processor) {
+            return processor->getInputPortname() == input;
+        });
+        if (alreadyOpen)
+            continue;
+        try {
+            midiInputProcessors.push_back(createMidiProcessor(input, popts, oscOutputs, oscBundler));
+        } catch (const std::out_of_range&) {
+            // It went away again while we were at it. Will be picked up on the next change
+            OSMID_LOG_WARN(MonitorLogger::getInstance(), "Could not open MIDI input {}", input);
+        }
+    }
+}
+
 static std::atomic<bool> g_wantToExit(false);
+#if OSMID_ALSA
+static AlsaDeviceWatcher* g_deviceWatcher = nullptr;
+#endif
 
 #if WIN32
 BOOL ctrlHandler(DWORD fdwCtrlType)
@@ -150,6 +214,10 @@ void ctrlHandler(int signal)
 {
     cout << "Ctrl-C event" << endl;
     g_wantToExit = true;
+#if OSMID_ALSA
+    if (g_deviceWatcher)
+        g_deviceWatcher->interrupt();
+#endif
 }
 #endif
 
@@ -163,17 +231,76 @@ void sendHeartBeat(const vector<unique_ptr<MidiInProcessor> >& midiProcessors, c
       p << midiProcessor->getInputId() << midiProcessor->getInputPortname().c_str() << midiProcessor->getInputNormalizedPortName().c_str();
     }
     p << osc::EndMessage;
-    MonitorLogger::getInstance().debug("sending OSC: [/m2o/heartbeat] -> ");
+    OSMID_LOG_DEBUG(MonitorLogger::getInstance(), "sending OSC: [/m2o/heartbeat] -> ");
+    for (const auto& midiProcessor : midiProcessors) {
+        OSMID_LOG_DEBUG(MonitorLogger::getInstance(), "   {}, {}", midiProcessor->getInputId(), midiProcessor->getInputPortname());
+    }
+
+    for (auto& output : oscOutputs) {
+        output->sendUDPNow(p.Data(), p.Size());
+        local_utils::logOSCMessage(p.Data(), p.Size());
+    }
+}
+
+// Reports, for every OSC output port, how many packets were sent and in how many system calls
+void sendBatchingStats(const vector<shared_ptr<OscOutput> >& oscOutputs)
+{
+    char buffer[1024];
+    osc::OutboundPacketStream p(buffer, 1024);
+    p << osc::BeginMessage("/m2o/udp_batching");
+    for (const auto& output : oscOutputs) {
+        uint64_t packets = output->getPacketsSent();
+        uint64_t calls = output->getSendCalls();
+        p << output->getPort() << (osc::int64)packets << (osc::int64)calls << (calls > 0 ? (float)packets / calls : 0.0f);
+    }
+    p << osc::EndMessage;
+
+    for (auto& output : oscOutputs) {
+        output->sendUDPNow(p.Data(), p.Size());
+        local_utils::logOSCMessage(p.Data(), p.Size());
+    }
+}
+
+// Reports, for every MIDI input, how full its queue to the OSC sender is, the most it has been, and how many messages it had to drop
+void sendQueueStats(const vector<unique_ptr<MidiInProcessor> >& midiProcessors, const vector<shared_ptr<OscOutput> >& oscOutputs)
+{
+    char buffer[2048];
+    osc::OutboundPacketStream p(buffer, 2048);
+    p << osc::BeginMessage("/m2o/input_queues");
     for (const auto& midiProcessor : midiProcessors) {
-        MonitorLogger::getInstance().debug("   {}, {}", midiProcessor->getInputId(), midiProcessor->getInputPortname());
+        p << midiProcessor->getInputId() << (int)midiProcessor->getQueueDepth() << (int)midiProcessor->getMaxQueueDepth() << (osc::int64)midiProcessor->getQueueOverflows();
     }
+    p << osc::EndMessage;
 
     for (auto& output : oscOutputs) {
-        output->sendUDP(p.Data(), p.Size());
+        output->sendUDPNow(p.Data(), p.Size());
         local_utils::logOSCMessage(p.Data(), p.Size());
     }
 }
 
+// Reports, for every MIDI input and type of message, how long the messages took from arriving to being sent as OSC, since the previous report
+void sendLatencyStats(const vector<unique_ptr<MidiInProcessor> >& midiProcessors, const vector<shared_ptr<OscOutput> >& oscOutputs)
+{
+    // One message per input, 24 message types don't leave room for more
+    for (const auto& midiProcessor : midiProcessors) {
+        char buffer[2048];
+        osc::OutboundPacketStream p(buffer, 2048);
+        p << osc::BeginMessage("/m2o/stats") << midiProcessor->getInputId();
+        for (int statusSlot = 0; statusSlot < midi_status::N_STATUS_SLOTS; statusSlot++) {
+            LatencySummary latency = midiProcessor->takeLatency(statusSlot);
+            if (latency.count == 0)
+                continue;
+            p << midi_status::getStatusInfo(statusSlot).name << (osc::int64)latency.count << latency.p50 << latency.p99 << latency.p999 << latency.max;
+        }
+        p << osc::EndMessage;
+
+        for (auto& output : oscOutputs) {
+            output->sendUDPNow(p.Data(), p.Size());
+            local_utils::logOSCMessage(p.Data(), p.Size());
+        }
+    }
+}
+
 int main(int argc, char* argv[])
 {
     // midiInputProcessors will contain the list of active MidiIns at a given time
@@ -194,12 +321,25 @@ int main(int argc, char* argv[])
 
     MonitorLogger::getInstance().setLogLevel(popts.monitor);
 
+    // Before any of the threads that handle MIDI and OSC start
+    realtime::setThreadOptions(static_cast<int>(popts.rtPriority), popts.cpus);
+    if (popts.lockMemory)
+        realtime::lockMemory();
+
     // Open the OSC output ports
     for (auto port : popts.oscOutputPorts) {
         auto oscOutput = make_shared<OscOutput>(popts.oscOutputHost, port);
+        if (popts.udpBatchDelay > 0)
+            oscOutput->enableBatching(std::chrono::microseconds(popts.udpBatchDelay));
         oscOutputs.push_back(std::move(oscOutput));
     }
 
+    // All the inputs add their messages to the same bundles
+    shared_ptr<OscBundler> oscBundler;
+    if (popts.oscBundleWindow > 0) {
+        oscBundler = make_shared<OscBundler>(oscOutputs, std::chrono::microseconds(popts.oscBundleWindow));
+    }
+
     // Will configure logging on the first OSC port (may want to change this in the future, so that it sends to every port, or be able to select one)
     MonitorLogger::getInstance().setOscOutput(oscOutputs[0]);
 
@@ -207,13 +347,19 @@ int main(int argc, char* argv[])
 #ifndef WIN32
     unique_ptr<MidiInProcessor> virtualIn;
     if (popts.useVirtualPort) {
-        virtualIn = make_unique<MidiInProcessor>(popts.virtualPortName, oscOutputs, true);
+        MidiInProcessor::OscSettings oscSettings;
+        oscSettings.oscBundler = oscBundler;
+        virtualIn = make_unique<MidiInProcessor>(popts.virtualPortName, oscOutputs, oscSettings, true, false, popts.queueSize);
     }
 #endif
 
+#if OSMID_ALSA
+    AlsaSeqIn::setNumClients(static_cast<int>(popts.seqClients));
+#endif
+
     // Open the MIDI input ports
     try {
-        prepareMidiProcessors(midiInputProcessors, popts, oscOutputs);
+        prepareMidiProcessors(midiInputProcessors, popts, oscOutputs, oscBundler);
     } catch (const std::out_of_range&) {
         return -1;
     }
@@ -231,20 +377,59 @@ int main(int argc, char* argv[])
 #endif
 
 
-    // For hotplugging
+    // For hotplugging. On Linux we are told about the changes by the ALSA sequencer, otherwise we check every second
+#if OSMID_ALSA
+    unique_ptr<AlsaDeviceWatcher> deviceWatcher = make_unique<AlsaDeviceWatcher>("m2o_watcher", true);
+    if (deviceWatcher->isValid())
+        g_deviceWatcher = deviceWatcher.get();
+#endif
+    const std::chrono::milliseconds heartbeatPeriod(1000);
+    auto nextHeartbeat = std::chrono::steady_clock::now() + heartbeatPeriod;
     vector<string> lastAvailablePorts = MidiIn::getInputNames();
     while (!g_wantToExit) {
-        std::chrono::milliseconds timespan(1000);
-        std::this_thread::sleep_for(timespan);
-        vector<string> newAvailablePorts = MidiIn::getInputNames();
-        // Was something added or removed?
-        if (newAvailablePorts != lastAvailablePorts) {
-            midiInputProcessors.clear();
-            prepareMidiProcessors(midiInputProcessors, popts, oscOutputs);
+        bool changed = false;
+        vector<string> removedPorts;
+        vector<string> newAvailablePorts;
+#if OSMID_ALSA
+        if (g_deviceWatcher) {
+            // Without a heartbeat there is nothing to do until something changes
+            int timeoutMs = -1;
+            if (popts.oscHeartbeat) {
+                auto untilHeartbeat = std::chrono::duration_cast<std::chrono::milliseconds>(nextHeartbeat - std::chrono::steady_clock::now());
+                timeoutMs = static_cast<int>(max<long long>(untilHeartbeat.count(), 0));
+            }
+            changed = g_deviceWatcher->waitForChanges(timeoutMs, removedPorts);
+            if (changed)
+                newAvailablePorts = MidiIn::scanInputs()->names;
+        } else
+#endif
+        {
+            std::this_thread::sleep_until(nextHeartbeat);
+            newAvailablePorts = MidiIn::scanInputs()->names;
+            // Was something added or removed?
+            changed = (newAvailablePorts != lastAvailablePorts);
+        }
+
+        if (changed && !g_wantToExit) {
+            updateMidiProcessors(midiInputProcessors, popts, oscOutputs, oscBundler, newAvailablePorts, removedPorts);
             lastAvailablePorts = newAvailablePorts;
             listAvailablePorts();
         }
-        if (popts.oscHeartbeat)
-            sendHeartBeat(midiInputProcessors, oscOutputs);
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= nextHeartbeat) {
+            nextHeartbeat = max(nextHeartbeat + heartbeatPeriod, now);
+            if (popts.oscHeartbeat) {
+                sendHeartBeat(midiInputProcessors, oscOutputs);
+                if (popts.udpBatchDelay > 0)
+                    sendBatchingStats(oscOutputs);
+                if (popts.queueSize > 0)
+                    sendQueueStats(midiInputProcessors, oscOutputs);
+                sendLatencyStats(midiInputProcessors, oscOutputs);
+            }
+        }
     }
+#if OSMID_ALSA
+    g_deviceWatcher = nullptr;
+#endif
 }
@@ -25,66 +25,42 @@
 
 using namespace std;
 
-map<string, int> MidiCommon::m_midiNameToJuceMidiId;
-map<string, int> MidiCommon::m_midiNameToStickyId;
-vector<string> MidiCommon::m_midiJuceMidiIdToName;
-unsigned int MidiCommon::m_nStickyIds = 0;
-
-MidiCommon::MidiCommon() {}
+MidiCommon::MidiCommon(const string& portName)
+    : m_name(MidiRegistry::getInstance().intern(portName)),
+      m_juceMidiId(-1)
+{
+}
 
 MidiCommon::~MidiCommon()
 {
 }
 
-string MidiCommon::getPortName() const
+const string& MidiCommon::getPortName() const
 {
-    return m_portName;
+    return m_name.name;
 }
 
-string MidiCommon::getNormalizedPortName() const
+const string& MidiCommon::getNormalizedPortName() const
 {
-    return m_normalizedPortName;
+    return m_name.normalizedName;
 }
 
 int MidiCommon::getPortId() const
 {
-    return m_stickyId;
+    return m_name.stickyId;
 }
 
 // Checks if the name matches the id. They may stop matching because of adding or removing MIDI devices while running
-// This should be called after we detect a change in the list of MIDI devices, for finer control of which MidiIns to keep
+// This should be called after rescanning the MIDI devices, for finer control of which MidiIns to keep
 bool MidiCommon::checkValid() const
 {
-    auto strArray = MidiInput::getDevices();
-    int nPorts = strArray.size();
-    if (m_juceMidiId >= nPorts)
+    auto devices = getDeviceList();
+    int nPorts = static_cast<int>(devices->names.size());
+    if (m_juceMidiId < 0 || m_juceMidiId >= nPorts)
         return false;
 
-    string nameForId = strArray[m_juceMidiId].toStdString();
-    if (nameForId != m_portName)
+    if (devices->names[m_juceMidiId] != m_name.name)
         return false;
 
     return true;
 }
-
-int MidiCommon::getJuceMidiIdFromName(const string& portName)
-{
-    return m_midiNameToJuceMidiId.at(portName);
-}
-
-bool MidiCommon::nameInStickyTable(const string& portName)
-{
-    auto search = m_midiNameToStickyId.find(portName);
-    return (search != m_midiNameToStickyId.end());
-}
-
-unsigned int MidiCommon::addNameToStickyTable(const string& portName)
-{
-    m_midiNameToStickyId[portName] = m_nStickyIds;
-    return m_nStickyIds++;
-}
-
-unsigned int MidiCommon::getStickyIdFromName(const string& portName)
-{
-    return m_midiNameToStickyId[portName];
-}
@@ -26,15 +26,20 @@
 #include <thread>
 #include <memory>
 #include <vector>
-#include <map>
 #include <string>
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "monitorlogger.h"
+#include "midiregistry.h"
+
+// On Linux we can talk to the ALSA sequencer ourselves, for the things JUCE doesn't give us
+#if JUCE_LINUX && JUCE_ALSA
+#define OSMID_ALSA 1
+#endif
 
 // This class manages the common parts of our MIDI handling, like sticky ids
 class MidiCommon {
 public:
-    MidiCommon();
+    explicit MidiCommon(const std::string& portName);
     MidiCommon(const MidiCommon&) = delete;
     MidiCommon& operator=(const MidiCommon&) = delete;
 
@@ -42,24 +47,16 @@ public:
 
     bool checkValid() const;
 
-    std::string getPortName() const;
-    std::string getNormalizedPortName() const;
+    const std::string& getPortName() const;
+    const std::string& getNormalizedPortName() const;
     int getPortId() const;
-
-    static int getJuceMidiIdFromName(const std::string& portName);
+    // The interned name, for holders that want to outlive this port without copying strings
+    const MidiPortName& getInternedName() const { return m_name; }
 
 protected:
-    virtual void updateMidiDevicesNamesMapping() = 0;
-    std::string m_portName;
-    std::string m_normalizedPortName;
+    // The latest device list for the direction of this port
+    virtual std::shared_ptr<const MidiDeviceList> getDeviceList() const = 0;
+    const MidiPortName& m_name;
     int m_juceMidiId;
-    int m_stickyId;
-    static bool nameInStickyTable(const std::string& portName);
-    unsigned int addNameToStickyTable(const std::string& portName);
-    unsigned int getStickyIdFromName(const std::string& portName);
-    static std::map<std::string, int> m_midiNameToJuceMidiId;
-    static std::vector<std::string> m_midiJuceMidiIdToName;
-    static std::map<std::string, int> m_midiNameToStickyId;
-    static unsigned int m_nStickyIds;
     MonitorLogger &m_logger{ MonitorLogger::getInstance() };
 };
@@ -21,65 +21,171 @@
 // SOFTWARE.
 
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
 #include "midiin.h"
-#include "utils.h"
+#include "rcu.h"
+#if OSMID_ALSA
+#include "alsaseqin.h"
+#endif
 
 using namespace std;
 
-MidiIn::MidiIn(const string& portName, MidiInputCallback* midiInputCallback, bool isVirtual)
-{
-    m_logger.debug("MidiIn constructor for {}", portName);
-    updateMidiDevicesNamesMapping();
-    m_portName = portName;
-    m_normalizedPortName = portName;
-    local_utils::safeOscString(m_normalizedPortName);
+namespace local_utils {
+
+// JUCE calls the input callbacks without holding any lock, and doesn't wait for a running one when a device
+// is stopped or deleted. So the callback JUCE gets is always this router, which is never deleted, and it
+// forwards each message while holding a snapshot of the routes. Removing a route waits until no message
+// can still be forwarded with it, and a late call from JUCE just finds no route
+class JuceCallbackRouter : public MidiInputCallback {
+public:
+    static JuceCallbackRouter& getInstance()
+    {
+        // Not destroyed at exit, JUCE's threads may still be calling it
+        static JuceCallbackRouter* instance = new JuceCallbackRouter();
+        return *instance;
+    }
+
+    void handleIncomingMidiMessage(MidiInput* source, const MidiMessage& message) override
+    {
+        auto routes = m_routes.read();
+        auto found = routes->find(source);
+        if (found != routes->end())
+            found->second->handleIncomingMidiMessage(source, message);
+    }
+
+    void handlePartialSysexMessage(MidiInput* source, const uint8* messageData, int numBytesSoFar, double timestamp) override
+    {
+        auto routes = m_routes.read();
+        auto found = routes->find(source);
+        if (found != routes->end())
+            found->second->handlePartialSysexMessage(source, messageData, numBytesSoFar, timestamp);
+    }
+
+    void addRoute(const MidiInput* input, MidiInputCallback* callback)
+    {
+        lock_guard<mutex> lock(m_routesMutex);
+        auto routes = make_unique<Routes>(*m_routes.read());
+        (*routes)[input] = callback;
+        m_routes.publish(std::move(routes));
+    }
 
-    if (!nameInStickyTable(m_portName))
-        m_stickyId = addNameToStickyTable(m_portName);
-    else
-        m_stickyId = getStickyIdFromName(m_portName);
+    // Once this returns, the callback of the route is not running and won't be called again
+    void removeRoute(const MidiInput* input)
+    {
+        lock_guard<mutex> lock(m_routesMutex);
+        auto routes = make_unique<Routes>(*m_routes.read());
+        routes->erase(input);
+        m_routes.publish(std::move(routes));
+    }
+
+    // Waits for the messages that are being forwarded right now
+    void synchronize() { m_routes.synchronize(); }
+
+private:
+    typedef unordered_map<const MidiInput*, MidiInputCallback*> Routes;
+    JuceCallbackRouter() {}
+
+    RcuSnapshot<Routes> m_routes;
+    mutex m_routesMutex;
+};
+}
 
+MidiIn::MidiIn(const string& portName, MidiInputCallback* midiInputCallback, bool isVirtual, NativeMidiInputCallback* nativeCallback)
+    : MidiCommon(portName),
+      m_midiIn(nullptr),
+      m_native(false)
+{
+    OSMID_LOG_DEBUG(m_logger, "MidiIn constructor for {}", portName);
     // FIXME: need to check if name does not exist
     if (!isVirtual) {
-        m_juceMidiId = getJuceMidiIdFromName(m_portName);
-        m_midiIn = MidiInput::openDevice(m_juceMidiId, midiInputCallback);
+        m_juceMidiId = getInputList()->getJuceMidiId(m_name.name);
+#if OSMID_ALSA
+        if (nativeCallback != nullptr) {
+            m_seqIn = AlsaSeqIn::getInstance();
+            if (m_seqIn && m_seqIn->findSource(m_name.name, m_seqClient, m_seqPort)) {
+                m_native = true;
+                m_nativeCallback = nativeCallback;
+                OSMID_LOG_DEBUG(m_logger, "Using the ALSA sequencer input for {}", m_name.name);
+                return;
+            }
+            OSMID_LOG_INFO(m_logger, "Could not use the ALSA sequencer input for {}, falling back to JUCE", m_name.name);
+            m_seqIn.reset();
+        }
+#endif
+        m_midiIn = MidiInput::openDevice(m_juceMidiId, &local_utils::JuceCallbackRouter::getInstance());
     }
     else {
 #ifndef WIN32
-        m_logger.trace("*** Creating new MIDI device: ", m_portName);
-        m_midiIn = MidiInput::createNewDevice(m_portName, midiInputCallback);
+        OSMID_LOG_TRACE(m_logger, "*** Creating new MIDI device: ", m_name.name);
+        m_midiIn = MidiInput::createNewDevice(m_name.name, &local_utils::JuceCallbackRouter::getInstance());
 #else
-        m_logger.error("Virtual MIDI ports are not supported on Windows");
+        OSMID_LOG_ERROR(m_logger, "Virtual MIDI ports are not supported on Windows");
         exit(-1);
 #endif
     }
+    // Before the input is started, so no message is lost
+    if (m_midiIn != nullptr)
+        local_utils::JuceCallbackRouter::getInstance().addRoute(m_midiIn, midiInputCallback);
+}
 
+MidiIn::~MidiIn()
+{
+    OSMID_LOG_TRACE(m_logger, "MidiIn destructor for {}", m_name.name);
+    stop();
+    if (m_midiIn != nullptr) {
+        local_utils::JuceCallbackRouter::getInstance().removeRoute(m_midiIn);
+        delete m_midiIn;
+    }
+}
+
+void MidiIn::start()
+{
+#if OSMID_ALSA
+    if (m_native) {
+        m_seqIn->subscribe(m_seqClient, m_seqPort, m_nativeCallback);
+        return;
+    }
+#endif
     m_midiIn->start();
 }
 
-MidiIn::~MidiIn()
+void MidiIn::stop()
 {
-    m_logger.trace("MidiIn destructor for {}", m_portName);
+#if OSMID_ALSA
+    if (m_native) {
+        m_seqIn->unsubscribe(m_seqClient, m_seqPort);
+        return;
+    }
+#endif
     m_midiIn->stop();
-    delete m_midiIn;
+    // Like the native input, don't return while a callback may still be running
+    local_utils::JuceCallbackRouter::getInstance().synchronize();
 }
 
-vector<string> MidiIn::getInputNames()
+shared_ptr<const MidiDeviceList> MidiIn::scanInputs()
 {
-    auto strArray = MidiInput::getDevices();
-    int nPorts = strArray.size();
-    vector<string> names(nPorts);
+    auto inputList = MidiRegistry::getInstance().setDevices(MidiRegistry::Input, MidiInput::getDevices());
+#if OSMID_ALSA
+    AlsaSeqIn::invalidateSources();
+#endif
+    return inputList;
+}
 
-    for (int i = 0; i < nPorts; i++) {
-        names[i] = strArray[i].toStdString();
-    }
-    return names;
+shared_ptr<const MidiDeviceList> MidiIn::getInputList()
+{
+    auto inputList = MidiRegistry::getInstance().getDevices(MidiRegistry::Input);
+    if (inputList)
+        return inputList;
+    return scanInputs();
 }
 
-void MidiIn::updateMidiDevicesNamesMapping()
+vector<string> MidiIn::getInputNames()
 {
-    m_midiJuceMidiIdToName = MidiIn::getInputNames();
-    for (int i = 0; i < m_midiJuceMidiIdToName.size(); i++) {
-        m_midiNameToJuceMidiId[m_midiJuceMidiIdToName[i]] = i;
-    }
+    return getInputList()->names;
+}
+
+shared_ptr<const MidiDeviceList> MidiIn::getDeviceList() const
+{
+    return getInputList();
 }
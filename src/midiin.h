@@ -24,21 +24,54 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <cstdint>
 #include "midicommon.h"
 #include "../JuceLibraryCode/JuceHeader.h"
 
-// This class manages a MIDI input device as seen by JUCE
+// On Linux, inputs can read the ALSA sequencer directly instead of going through JUCE
+#if OSMID_ALSA
+class AlsaSeqIn;
+#endif
+
+// Receives the messages of the native MIDI input, with the status slot (see midistatus.h) and channel (1-16, or 0xff for none) already worked out
+class NativeMidiInputCallback {
+public:
+    virtual ~NativeMidiInputCallback() {}
+    virtual void handleIncomingMidiBytes(int statusSlot, unsigned char channel, const uint8_t* message, int nBytes) = 0;
+    // Called once the input has handled all the events that were pending, so batched output can go out now
+    virtual void handleEndOfBurst() {}
+};
+
+// This class manages a MIDI input device as seen by JUCE, or by the native input when there is one and a nativeCallback is given
 class MidiIn : public MidiCommon {
 public:
-    MidiIn(const std::string& portName, MidiInputCallback* midiInputCallback, bool isVirtual = false);
+    MidiIn(const std::string& portName, MidiInputCallback* midiInputCallback, bool isVirtual = false, NativeMidiInputCallback* nativeCallback = nullptr);
     MidiIn(const MidiIn&) = delete;
     MidiIn& operator=(const MidiIn&) = delete;
 
     virtual ~MidiIn();
 
+    void start();
+    // Once this returns, no callback is running. One that JUCE was already about to make may still come
+    // until the MidiIn is deleted, and never after that
+    void stop();
+    bool isNative() const { return m_native; }
+
+    // Enumerates the input devices once, and keeps the list for getInputNames() and for the ports opened after it
+    static std::shared_ptr<const MidiDeviceList> scanInputs();
+    // The names from the latest scan. Only scans if there was none yet
     static std::vector<std::string> getInputNames();
 
 protected:
-    void updateMidiDevicesNamesMapping() override;
+    std::shared_ptr<const MidiDeviceList> getDeviceList() const override;
+    static std::shared_ptr<const MidiDeviceList> getInputList();
     MidiInput* m_midiIn;
+    bool m_native;
+#if OSMID_ALSA
+    std::shared_ptr<AlsaSeqIn> m_seqIn;
+    NativeMidiInputCallback* m_nativeCallback;
+    int m_seqClient;
+    int m_seqPort;
+#endif
 };
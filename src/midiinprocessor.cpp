@@ -20,248 +20,296 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
-#include <regex>
 #include <algorithm>
 #include <sstream>
-#include <cassert>
+#include <chrono>
+#include <thread>
+#include <cstring>
 #include "midiinprocessor.h"
 #include "osc/OscOutboundPacketStream.h"
 #include "utils.h"
+#include "realtime.h"
 
 using namespace std;
 
-regex MidiInProcessor::regexName{ "\\$n" };
-regex MidiInProcessor::regexId{ "\\$i" };
-regex MidiInProcessor::regexChannel{ "\\$c" };
-regex MidiInProcessor::regexMessageType{ "\\$m" };
-regex MidiInProcessor::regexDoubleSlash{ "//" };
-
-MidiInProcessor::MidiInProcessor(const std::string& inputName, vector<shared_ptr<OscOutput> > outputs, bool isVirtual)
+MidiInProcessor::MidiInProcessor(const std::string& inputName, vector<shared_ptr<OscOutput> > outputs, const OscSettings& oscSettings, bool isVirtual, bool nativeInput, size_t queueSize)
     : m_outputs(outputs),
-      m_useOscTemplate(false),
-      m_oscRawMidiMessage(false)
+      m_useOscTemplate(oscSettings.useOscTemplate),
+      m_oscRawMidiMessage(oscSettings.oscRawMidiMessage),
+      m_oscBundler(oscSettings.oscBundler),
+      m_acceptingCallbacks(false),
+      m_queuedCount(0),
+      m_sentCount(0),
+      m_queueOverflows(0),
+      m_maxQueueDepth(0),
+      m_senderWaiting(false),
+      m_senderExit(false)
+{
+    m_input = make_unique<MidiIn>(inputName, this, isVirtual, nativeInput ? this : nullptr);
+    m_portName = &m_input->getInternedName();
+    if (m_useOscTemplate) {
+        m_oscTemplate = OscTemplate(oscSettings.oscTemplate);
+    }
+    buildAddressCache();
+    if (queueSize > 0) {
+        m_queue = make_unique<SpscRing<QueuedMidiMessage> >(queueSize);
+        m_senderThread = thread(&MidiInProcessor::senderThread, this);
+    }
+    resumeInput();
+}
+
+MidiInProcessor::~MidiInProcessor()
+{
+    // Stop the callbacks, and close the device (after which no late callback can come) before the rest of the members go away
+    pauseInput();
+    m_input.reset();
+    if (m_queue) {
+        {
+            lock_guard<mutex> lock(m_senderMutex);
+            m_senderExit = true;
+        }
+        m_senderCondition.notify_one();
+        m_senderThread.join();
+    }
+}
+
+void MidiInProcessor::pauseInput()
+{
+    // Stopping the input waits for the callback that may be running
+    m_acceptingCallbacks = false;
+    m_input->stop();
+    // Nothing is being queued now, wait for the sender to catch up
+    while (m_queue && m_sentCount.load(memory_order_acquire) != m_queuedCount.load(memory_order_relaxed)) {
+        this_thread::yield();
+    }
+}
+
+void MidiInProcessor::resumeInput()
+{
+    m_acceptingCallbacks = true;
+    m_input->start();
+}
+
+void MidiInProcessor::buildAddressCache()
+{
+    m_addressCache.assign(midi_status::N_STATUS_SLOTS * midi_status::N_CHANNEL_SLOTS, string());
+    for (int statusSlot = 0; statusSlot < midi_status::N_STATUS_SLOTS; statusSlot++) {
+        // Channel slot 0 holds the address for messages without a channel
+        for (int channel = 0; channel < midi_status::N_CHANNEL_SLOTS; channel++) {
+            string& address = m_addressCache[statusSlot * midi_status::N_CHANNEL_SLOTS + channel];
+            if (m_useOscTemplate) {
+                char buffer[256];
+                m_oscTemplate.expand(buffer, sizeof(buffer), m_portName->normalizedName, m_portName->stickyId, (channel != 0 ? channel : 0xff), midi_status::getStatusInfo(statusSlot).name);
+                address = buffer;
+            } else {
+                stringstream path;
+                path << "/midi/" << m_portName->normalizedName << "/" << m_portName->stickyId;
+                if (channel != 0) {
+                    path << "/" << channel;
+                }
+                path << "/" << midi_status::getStatusInfo(statusSlot).name;
+                address = path.str();
+            }
+        }
+    }
+}
+
+const string& MidiInProcessor::getCachedAddress(int statusSlot, unsigned char channel) const
 {
-    m_input = make_unique<MidiIn>(inputName, this, isVirtual);
+    return m_addressCache[statusSlot * midi_status::N_CHANNEL_SLOTS + (channel == 0xff ? 0 : channel)];
 }
 
 void MidiInProcessor::handleIncomingMidiMessage(MidiInput* source, const juce::MidiMessage& midiMessage)
 {
     unsigned char channel = 0xff, status = 0;
-    string message_type;
     const uint8_t* message = midiMessage.getRawData();
     int nBytes = midiMessage.getRawDataSize();
 
-    assert(nBytes > 0);
-
-    if ((message[0] & 0xf0) != 0xf0) {
-        channel = message[0] & 0x0f;
-        channel++; // Make channel 1-16, instead of 0-15
-        status = message[0] & 0xf0;
+    if (!m_acceptingCallbacks)
+        return;
+    // JUCE starts this thread itself, so this is our first chance to set it up
+    realtime::setupCurrentThreadOnce("JUCE MIDI input");
+    if (nBytes <= 0) {
+        OSMID_LOG_WARN(m_logger, "Dropping empty MIDI message from {}", m_portName->normalizedName);
     } else {
-        status = message[0];
+        if ((message[0] & 0xf0) != 0xf0) {
+            channel = message[0] & 0x0f;
+            channel++; // Make channel 1-16, instead of 0-15
+            status = message[0] & 0xf0;
+        } else {
+            status = message[0];
+        }
+        receiveMidiMessage(midi_status::getStatusSlot(status), channel, message, nBytes);
+    }
+    // JUCE calls us once per message, so each call is a burst of its own. With a queue the sender flushes
+    if (!m_queue) {
+        flushOutputs();
     }
+}
 
-    dumpMIDIMessage(message, nBytes);
+// The native input already knows the status and channel of the message, so it comes straight here
+void MidiInProcessor::handleIncomingMidiBytes(int statusSlot, unsigned char channel, const uint8_t* message, int nBytes)
+{
+    receiveMidiMessage(statusSlot, channel, message, nBytes);
+}
 
-    // Process the message
-    switch (status) {
-    case 0x80:
-        message_type = "note_off";
-        assert(nBytes == 3);
-        break;
-
-    case 0x90:
-        message_type = "note_on";
-        assert(nBytes == 3);
-        break;
-
-    case 0xA0:
-        message_type = "polyphonic_key_pressure";
-        assert(nBytes == 3);
-        break;
-
-    case 0xB0:
-        message_type = "control_change";
-        assert(nBytes == 3);
-        break;
-
-    case 0xC0:
-        message_type = "program_change";
-        assert(nBytes == 2);
-        break;
-
-    case 0xD0:
-        message_type = "channel_pressure";
-        assert(nBytes == 2);
-        break;
-
-    case 0xE0:
-        message_type = "pitch_bend";
-        assert(nBytes == 3);
-        break;
-
-    case 0xF0:
-        message_type = "sysex";
-        // Remove the end of message marker if raw message is not specified
-        if (!m_oscRawMidiMessage)
-            nBytes--;
-        break;
-
-    case 0xF1:
-        message_type = "MTC";
-        assert(nBytes == 2);
-        break;
-
-    case 0xF2:
-        message_type = "song_position";
-        assert(nBytes == 3);
-        break;
-
-    case 0xF3:
-        message_type = "song_select";
-        assert(nBytes == 2);
-        break;
-
-    case 0xF4:
-    case 0xF5:
-        message_type = "syscommon_undefined";
-        assert(nBytes == 1);
-        break;
-
-    case 0xF6:
-        message_type = "tune_request";
-        assert(nBytes == 1);
-        break;
-
-    case 0xF8:
-        message_type = "clock";
-        assert(nBytes == 1);
-        break;
-
-    case 0xF9:
-    case 0xFD:
-        message_type = "sysrt_undefined";
-        assert(nBytes == 1);
-        break;
-
-    case 0xFA:
-        message_type = "start";
-        assert(nBytes == 1);
-        break;
-
-    case 0xFB:
-        message_type = "continue";
-        assert(nBytes == 1);
-        break;
-
-    case 0xFC:
-        message_type = "stop";
-        assert(nBytes == 1);
-        break;
-
-    case 0xFE:
-        message_type = "active_sensing";
-        assert(nBytes == 1);
-        break;
-
-    default:
-        message_type = "unknown_message";
-        break;
+void MidiInProcessor::handleEndOfBurst()
+{
+    // With a queue, the sender flushes when it has emptied it
+    if (!m_queue) {
+        flushOutputs();
     }
+}
 
-    // Prepare the OSC address
-    stringstream path;
-    string normalizedPortName(m_input->getNormalizedPortName());
-    int portId = m_input->getPortId();
-    // Was a template specified?
-    if (m_useOscTemplate) {
-        string templateSubst(m_oscTemplate);
-        doTemplateSubst(templateSubst, normalizedPortName, portId, channel, message_type);
-        path << templateSubst;
-    } else {
-        path << "/midi/" << normalizedPortName << "/" << portId;
-        if (channel != 0xff) {
-            path << "/" << (int)channel;
-        }
-        path << "/" << message_type;
+void MidiInProcessor::flushOutputs()
+{
+    // The bundler sends (and flushes) the bundle itself when its window is over
+    if (m_oscBundler)
+        return;
+
+    for (auto& output : m_outputs) {
+        output->flush();
     }
+}
 
-    // And now prepare the OSC message body
-    char buffer[1024];
-    osc::OutboundPacketStream p(buffer, 1024);
-    p << osc::BeginMessage(path.str().c_str());
+// Runs on the MIDI input thread. When there is a queue, it only timestamps the message and queues it
+void MidiInProcessor::receiveMidiMessage(int statusSlot, unsigned char channel, const uint8_t* message, int nBytes)
+{
+    // The wall clock is for the bundle timetags, the steady one to measure how long we take
+    auto receiveTime = chrono::system_clock::now();
+    auto arrivalTime = chrono::steady_clock::now();
+    if (!m_queue) {
+        processMidiMessage(receiveTime, arrivalTime, statusSlot, channel, message, nBytes);
+        return;
+    }
 
-    // send the raw midi message as part of the body
-    // do we want a raw midi message?
-    if (m_oscRawMidiMessage) {
-        if (nBytes > 0) {
-            p << osc::Blob(message, static_cast<osc::osc_bundle_element_size_t>(nBytes));
-        }
+    QueuedMidiMessage queued;
+    queued.receiveTime = receiveTime;
+    queued.arrivalTime = arrivalTime;
+    queued.statusSlot = statusSlot;
+    queued.channel = channel;
+    queued.nBytes = nBytes;
+    queued.longMessage = nullptr;
+    if (nBytes <= static_cast<int>(sizeof(queued.bytes))) {
+        memcpy(queued.bytes, message, nBytes);
     } else {
-        // We treat the pitch bend differently. Instead of sending the bytes separately,
-        // we send the processed 14 bits value
-        if (midiMessage.isPitchWheel()) {
-            p << (int)(midiMessage.getPitchWheelValue());
-        }
-        else {
-            for (int i = 1; i < nBytes; i++) {
-                p << (int)message[i];
-            }
+        queued.longMessage = new vector<uint8_t>(message, message + nBytes);
+    }
+
+    if (!m_queue->push(queued)) {
+        delete queued.longMessage;
+        m_queueOverflows.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    m_queuedCount.fetch_add(1, memory_order_relaxed);
+    size_t depth = m_queue->size();
+    if (depth > m_maxQueueDepth.load(memory_order_relaxed)) {
+        m_maxQueueDepth.store(depth, memory_order_relaxed);
+    }
+
+    // Pairs with the fence in senderThread: either we see it waiting, or it sees the message
+    atomic_thread_fence(memory_order_seq_cst);
+    if (m_senderWaiting.load(memory_order_relaxed)) {
+        lock_guard<mutex> lock(m_senderMutex);
+        m_senderCondition.notify_one();
+    }
+}
+
+void MidiInProcessor::senderThread()
+{
+    realtime::setupCurrentThread("MIDI input sender");
+    QueuedMidiMessage queued;
+    for (;;) {
+        while (m_queue->pop(queued)) {
+            const uint8_t* message = (queued.longMessage ? queued.longMessage->data() : queued.bytes);
+            processMidiMessage(queued.receiveTime, queued.arrivalTime, queued.statusSlot, queued.channel, message, queued.nBytes);
+            delete queued.longMessage;
+            m_sentCount.fetch_add(1, memory_order_release);
         }
+        flushOutputs();
+
+        unique_lock<mutex> lock(m_senderMutex);
+        if (m_senderExit)
+            return;
+        m_senderWaiting.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        m_senderCondition.wait(lock, [this] { return m_senderExit || !m_queue->empty(); });
+        m_senderWaiting.store(false, memory_order_relaxed);
     }
-    p << osc::EndMessage;
+}
+
+void MidiInProcessor::processMidiMessage(chrono::system_clock::time_point receiveTime, chrono::steady_clock::time_point arrivalTime, int statusSlot, unsigned char channel, const uint8_t* message, int nBytes)
+{
+    dumpMIDIMessage(message, nBytes);
+
+    const midi_status::StatusInfo& statusInfo = midi_status::getStatusInfo(statusSlot);
+    if (!midi_status::isWellFormed(statusSlot, message, nBytes)) {
+        OSMID_LOG_WARN(m_logger, "Dropping malformed MIDI {} message ({} bytes) from {}", statusInfo.name, nBytes, m_portName->normalizedName);
+        return;
+    }
+
+    // The OSC address was already prepared when the processor was set up
+    const string& address = getCachedAddress(statusSlot, channel);
 
     // Dump the OSC message
-    m_logger.info("sending OSC: [{}] -> {}, {}", path.str(), portId, normalizedPortName);
-    if (m_oscRawMidiMessage) {
-        if (nBytes > 0) {
-            m_logger.info("  <raw_midi_message>");
-        }
-    } else {
-        for (int i = 1; i < nBytes; i++) {
-            m_logger.info("   [{:02x}]", (int)message[i]);
+    if (m_logger.shouldLog(spdlog::level::info)) {
+        OSMID_LOG_INFO(m_logger, "sending OSC: [{}] -> {}, {}", address, m_portName->stickyId, m_portName->normalizedName);
+        if (m_oscRawMidiMessage) {
+            OSMID_LOG_INFO(m_logger, "  <raw_midi_message>");
+        } else {
+            // The end of sysex marker is not sent
+            int nDataBytes = (statusInfo.encode == midi_status::encodeSysex ? nBytes - 1 : nBytes);
+            for (int i = 1; i < nDataBytes; i++) {
+                OSMID_LOG_INFO(m_logger, "   [{:02x}]", (int)message[i]);
+            }
         }
     }
 
-    //start_time = chrono::high_resolution_clock::now();
+    // In bundle mode the message is added to the current bundle, and sent later with it
+    if (m_oscBundler) {
+        m_oscBundler->addMessage(local_utils::toOscTimeTag(receiveTime), [&](osc::OutboundPacketStream& p) {
+            encodeOscMessage(p, address, statusInfo, message, nBytes);
+        });
+        m_latency[statusSlot].record(chrono::steady_clock::now() - arrivalTime);
+        return;
+    }
+
+    char buffer[1024];
+    osc::OutboundPacketStream p(buffer, 1024);
+    encodeOscMessage(p, address, statusInfo, message, nBytes);
 
     // And send the message to the specified output ports
     for (auto& output : m_outputs) {
         output->sendUDP(p.Data(), p.Size());
         local_utils::logOSCMessage(p.Data(), p.Size());
     }
+    m_latency[statusSlot].record(chrono::steady_clock::now() - arrivalTime);
 }
 
-void MidiInProcessor::setOscTemplate(const std::string& oscTemplate)
+void MidiInProcessor::encodeOscMessage(osc::OutboundPacketStream& p, const string& address, const midi_status::StatusInfo& statusInfo, const uint8_t* message, int nBytes) const
 {
-    m_oscTemplate = oscTemplate;
-    m_useOscTemplate = true;
-};
+    p << osc::BeginMessage(address.c_str());
 
-void MidiInProcessor::setOscRawMidiMessage(bool oscRawMidiMessage)
-{
-    m_oscRawMidiMessage = oscRawMidiMessage;
-}
-
-void MidiInProcessor::doTemplateSubst(string& str, const string& portName, int portId, int channel, const string& message_type) const
-{
-    str = regex_replace(regex_replace(regex_replace(regex_replace(str,
-                                                        regexMessageType, message_type),
-                                          regexChannel, (channel != 0xff ? to_string(channel) : "")),
-                            regexId, to_string(portId)),
-        regexName, portName);
-
-    // And now remove potential double slashes when the message does not have a channel, and remove potential slash at the end
-    str = regex_replace(str, regexDoubleSlash, "/");
-    if (str.back() == '/') {
-        str.pop_back();
+    // send the raw midi message as part of the body
+    // do we want a raw midi message?
+    if (m_oscRawMidiMessage) {
+        p << osc::Blob(message, static_cast<osc::osc_bundle_element_size_t>(nBytes));
+    } else {
+        statusInfo.encode(p, message, nBytes);
     }
+    p << osc::EndMessage;
 }
 
 void MidiInProcessor::dumpMIDIMessage(const uint8_t* message, int size) const
 {
-    m_logger.info("received MIDI message: ");
+    if (!m_logger.shouldLog(spdlog::level::info)) {
+        return;
+    }
+
+    // Log the whole message as a single record
+    fmt::MemoryWriter bytes;
     for (int i = 0; i < size; i++) {
-        m_logger.info("   [{:02x}]", (unsigned int)message[i]);
+        bytes.write(" [{:02x}]", (unsigned int)message[i]);
     }
+    OSMID_LOG_INFO(m_logger, "received MIDI message:{}", bytes.c_str());
 }
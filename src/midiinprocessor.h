@@ -23,36 +23,108 @@
 #pragma once
 #include <vector>
 #include <memory>
-#include <regex>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 
 #include "monitorlogger.h"
 #include "midiin.h"
 #include "oscout.h"
+#include "osctemplate.h"
+#include "oscbundler.h"
+#include "midistatus.h"
+#include "spscring.h"
+#include "latencyhistogram.h"
 
-class MidiInProcessor : public MidiInputCallback {
+class MidiInProcessor : public MidiInputCallback, public NativeMidiInputCallback {
 public:
-    MidiInProcessor(const std::string& inputName, std::vector<std::shared_ptr<OscOutput> > outputs, bool isVirtual = false);
+    // How the messages are turned into OSC. It is given to the constructor, so the input starts with it
+    struct OscSettings {
+        OscSettings()
+            : useOscTemplate(false),
+              oscRawMidiMessage(false)
+        {
+        }
+        bool useOscTemplate;
+        std::string oscTemplate;
+        bool oscRawMidiMessage;
+        // When there is one, the messages are added to its bundles instead of being sent to the outputs right away
+        std::shared_ptr<OscBundler> oscBundler;
+    };
+
+    // With a queueSize, the MIDI input thread only queues the messages, and a sender thread of this processor
+    // encodes and sends them. Messages that don't fit in a full queue are dropped. With 0 it's all done on the input thread
+    MidiInProcessor(const std::string& inputName, std::vector<std::shared_ptr<OscOutput> > outputs, const OscSettings& oscSettings, bool isVirtual = false, bool nativeInput = false, std::size_t queueSize = 0);
+    ~MidiInProcessor();
     void handleIncomingMidiMessage(MidiInput* source, const juce::MidiMessage& midiMessage) override;
-    void setOscTemplate(const std::string& oscTemplate);
-    void setOscRawMidiMessage(bool oscRawMidiMessage);
+    void handleIncomingMidiBytes(int statusSlot, unsigned char channel, const uint8_t* message, int nBytes) override;
+    void handleEndOfBurst() override;
     int getInputId() const { return m_input->getPortId(); };
     std::string getInputNormalizedPortName() const { return m_input->getNormalizedPortName(); };
     std::string getInputPortname() const { return m_input->getPortName(); };
+    bool isQueued() const { return m_queue != nullptr; }
+    std::size_t getQueueDepth() const { return m_queue ? m_queue->size() : 0; }
+    std::size_t getMaxQueueDepth() const { return m_maxQueueDepth; }
+    uint64_t getQueueOverflows() const { return m_queueOverflows; }
+    // Time from the MIDI message arriving to its OSC being sent (or added to the bundle), for one status type, since the previous call
+    LatencySummary takeLatency(int statusSlot) { return m_latency[statusSlot].takeSummary(); }
 
 protected:
-    void doTemplateSubst(std::string& str, const std::string& portName, int portId, int channel, const std::string& message_type) const;
+    // What the input thread queues. Messages that don't fit in bytes (sysex) are copied to the heap, and the sender deletes them
+    struct QueuedMidiMessage {
+        std::chrono::system_clock::time_point receiveTime;
+        std::chrono::steady_clock::time_point arrivalTime;
+        int statusSlot;
+        unsigned char channel;
+        int nBytes;
+        uint8_t bytes[3];
+        std::vector<uint8_t>* longMessage;
+    };
+
+    void receiveMidiMessage(int statusSlot, unsigned char channel, const uint8_t* message, int nBytes);
+    void processMidiMessage(std::chrono::system_clock::time_point receiveTime, std::chrono::steady_clock::time_point arrivalTime, int statusSlot, unsigned char channel, const uint8_t* message, int nBytes);
+    void senderThread();
+    // Sends what the outputs have batched, at the end of a burst of messages
+    void flushOutputs();
+    // Stops the input and waits until everything it produced has been sent
+    void pauseInput();
+    void resumeInput();
     void dumpMIDIMessage(const uint8_t* message, int size) const;
+    void encodeOscMessage(osc::OutboundPacketStream& p, const std::string& address, const midi_status::StatusInfo& statusInfo, const uint8_t* message, int nBytes) const;
+
+    // Every port can produce at most 16 channels x 24 status types, so the OSC address for each of them
+    // is computed once here and the hot path just looks it up
+    void buildAddressCache();
+    const std::string& getCachedAddress(int statusSlot, unsigned char channel) const;
+    std::vector<std::string> m_addressCache;
+    // Interned by the registry, so it stays valid and we don't keep our own copies of the names
+    const MidiPortName* m_portName;
+
     std::unique_ptr<MidiIn> m_input;
     std::vector<std::shared_ptr<OscOutput> > m_outputs;
     bool m_useOscTemplate;
-    std::string m_oscTemplate;
+    OscTemplate m_oscTemplate;
     bool m_oscRawMidiMessage;
+    std::shared_ptr<OscBundler> m_oscBundler;
+    // A JUCE callback can still arrive after the input was stopped (see MidiIn::stop), it is ignored when this is cleared
+    std::atomic<bool> m_acceptingCallbacks;
+
+    std::unique_ptr<SpscRing<QueuedMidiMessage> > m_queue;
+    std::atomic<uint64_t> m_queuedCount;
+    std::atomic<uint64_t> m_sentCount;
+    std::atomic<uint64_t> m_queueOverflows;
+    std::atomic<std::size_t> m_maxQueueDepth;
+    // Set by the sender before it sleeps, so the input thread only takes the mutex when it has someone to wake up
+    std::atomic<bool> m_senderWaiting;
+    bool m_senderExit;
+    std::mutex m_senderMutex;
+    std::condition_variable m_senderCondition;
+    std::thread m_senderThread;
 
-    // To avoid having to construct the regex everytime
-    static std::regex regexName;
-    static std::regex regexId;
-    static std::regex regexChannel;
-    static std::regex regexMessageType;
-    static std::regex regexDoubleSlash;
+    LatencyHistogram m_latency[midi_status::N_STATUS_SLOTS];
     MonitorLogger& m_logger{ MonitorLogger::getInstance() };
 };
@@ -22,61 +22,279 @@
 
 #include <iostream>
 #include "midiout.h"
-#include "utils.h"
+#include "realtime.h"
 
 using namespace std;
 
+mutex MidiOut::m_juceClientMutex;
+
 MidiOut::MidiOut(const string& portName)
+    : MidiCommon(portName),
+      m_buffered(false),
+      m_drainCount(0),
+      m_drainedEventCount(0),
+      m_failedDrainCount(0),
+      m_maxQueueDepth(0),
+      m_queueOverflows(0),
+      m_workerWaiting(false),
+      m_workerExit(false)
 {
-    m_logger.debug("MidiOut constructor for {}", portName);
-    updateMidiDevicesNamesMapping();
-    m_portName = portName;
-    m_normalizedPortName = portName;
-    local_utils::safeOscString(m_normalizedPortName);
-
-    if (!nameInStickyTable(m_portName))
-        m_stickyId = addNameToStickyTable(m_portName);
-    else
-        m_stickyId = getStickyIdFromName(m_portName);
-
-    m_juceMidiId = getJuceMidiIdFromName(m_portName);
+    OSMID_LOG_DEBUG(m_logger, "MidiOut constructor for {}", portName);
+    m_juceMidiId = getOutputList()->getJuceMidiId(m_name.name);
 
     // FIXME: need to check if name does not exist
+    lock_guard<mutex> lock(m_juceClientMutex);
     m_midiOut = MidiOutput::openDevice(m_juceMidiId);
 }
 
 MidiOut::~MidiOut()
 {
-    m_logger.trace("MidiOut destructor for {}", m_portName);
+    OSMID_LOG_TRACE(m_logger, "MidiOut destructor for {}", m_name.name);
+    drain();
+    stopWorker();
+    lock_guard<mutex> lock(m_juceClientMutex);
     delete m_midiOut;
 }
 
-void MidiOut::send(const juce::MidiMessage& message)
+void MidiOut::send(const juce::MidiMessage& message, chrono::steady_clock::time_point arrivalTime)
+{
+    if (m_logger.shouldLog(spdlog::level::info)) {
+        OSMID_LOG_INFO(m_logger, "Sending MIDI to: {} ->", m_name.name);
+        auto* data = message.getRawData();
+        for (int i = 0; i < message.getRawDataSize(); i++) {
+            OSMID_LOG_INFO(m_logger, "   [{:02x}]", data[i]);
+        }
+    }
+    if (m_buffered) {
+        m_pending.addEvent(message, 0);
+        m_pendingArrivalTimes.push_back(arrivalTime);
+        return;
+    }
+    if (m_queue) {
+        if (queueMessage(message, SINGLE, arrivalTime))
+            wakeWorker();
+        return;
+    }
+    sendNow(message);
+    recordLatency(message, arrivalTime, chrono::steady_clock::now());
+}
+
+void MidiOut::send(const juce::MidiBuffer& messages, chrono::steady_clock::time_point arrivalTime)
 {
-    m_logger.info("Sending MIDI to: {} ->", m_portName);
-    auto* data = message.getRawData();
-    for (int i = 0; i < message.getRawDataSize(); i++) {
-        m_logger.info("   [{:02x}]", data[i]);
+    if (m_logger.shouldLog(spdlog::level::info)) {
+        OSMID_LOG_INFO(m_logger, "Sending {} MIDI messages to: {} ->", messages.getNumEvents(), m_name.name);
+        MidiBuffer::Iterator it(messages);
+        MidiMessage message;
+        int samplePosition;
+        while (it.getNextEvent(message, samplePosition)) {
+            auto* data = message.getRawData();
+            for (int i = 0; i < message.getRawDataSize(); i++) {
+                OSMID_LOG_INFO(m_logger, "   [{:02x}]", data[i]);
+            }
+        }
+    }
+    if (m_buffered) {
+        m_pending.addEvents(messages, 0, -1, 0);
+        m_pendingArrivalTimes.insert(m_pendingArrivalTimes.end(), messages.getNumEvents(), arrivalTime);
+        return;
+    }
+    m_blockArrivalTimes.assign(messages.getNumEvents(), arrivalTime);
+    sendBlock(messages, m_blockArrivalTimes);
+}
+
+void MidiOut::sendBlock(const juce::MidiBuffer& messages, const ArrivalTimes& arrivalTimes)
+{
+    if (!m_queue) {
+        sendBlockNow(messages);
+        recordLatency(messages, arrivalTimes);
+        return;
+    }
+
+    // A block is queued whole or not at all. Only the worker frees space, so the room we see can only grow
+    int nMessages = messages.getNumEvents();
+    if (nMessages == 0)
+        return;
+    if (m_queue->capacity() - m_queue->size() < static_cast<size_t>(nMessages)) {
+        m_queueOverflows += nMessages;
+        return;
+    }
+    MidiBuffer::Iterator it(messages);
+    MidiMessage message;
+    int samplePosition;
+    for (int i = 1; it.getNextEvent(message, samplePosition); i++) {
+        queueMessage(message, (i < nMessages ? BLOCK_PART : BLOCK_END), arrivalTimes[i - 1]);
     }
+    wakeWorker();
+}
+
+void MidiOut::sendNow(const juce::MidiMessage& message)
+{
+    lock_guard<mutex> lock(m_juceClientMutex);
     m_midiOut->sendMessageNow(message);
 }
 
-vector<string> MidiOut::getOutputNames()
+bool MidiOut::sendBlockNow(const juce::MidiBuffer& messages)
 {
-    auto strArray = MidiOutput::getDevices();
-    int nPorts = strArray.size();
-    vector<string> names(nPorts);
+    bool sent;
+    {
+        lock_guard<mutex> lock(m_juceClientMutex);
+        sent = m_midiOut->sendBlockOfMessagesNow(messages);
+    }
+    if (!sent) {
+        m_failedDrainCount++;
+        OSMID_LOG_WARN(m_logger, "MIDI output {} did not take a block of {} messages in time, the rest of it was dropped", m_name.name, messages.getNumEvents());
+    }
+    return sent;
+}
 
-    for (int i = 0; i < nPorts; i++) {
-        names[i] = strArray[i].toStdString();
+bool MidiOut::queueMessage(const juce::MidiMessage& message, QueuedKind kind, chrono::steady_clock::time_point arrivalTime)
+{
+    QueuedMidiMessage queued;
+    queued.message = message;
+    queued.kind = kind;
+    queued.arrivalTime = arrivalTime;
+    if (!m_queue->push(queued)) {
+        m_queueOverflows++;
+        return false;
+    }
+    size_t depth = m_queue->size();
+    if (depth > m_maxQueueDepth.load(memory_order_relaxed)) {
+        m_maxQueueDepth.store(depth, memory_order_relaxed);
     }
-    return names;
+    return true;
 }
 
-void MidiOut::updateMidiDevicesNamesMapping()
+void MidiOut::wakeWorker()
 {
-    m_midiJuceMidiIdToName = MidiOut::getOutputNames();
-    for (int i = 0; i < m_midiJuceMidiIdToName.size(); i++) {
-        m_midiNameToJuceMidiId[m_midiJuceMidiIdToName[i]] = i;
+    // Pairs with the fence in workerThread: either we see it waiting, or it sees the messages
+    atomic_thread_fence(memory_order_seq_cst);
+    if (m_workerWaiting.load(memory_order_relaxed)) {
+        lock_guard<mutex> lock(m_workerMutex);
+        m_workerCondition.notify_one();
     }
 }
+
+void MidiOut::startWorker(size_t queueSize)
+{
+    if (m_queue || queueSize == 0)
+        return;
+    m_queue = make_unique<SpscRing<QueuedMidiMessage> >(queueSize);
+    m_workerThread = thread(&MidiOut::workerThread, this);
+}
+
+void MidiOut::stopWorker()
+{
+    if (!m_queue)
+        return;
+    {
+        lock_guard<mutex> lock(m_workerMutex);
+        m_workerExit = true;
+    }
+    m_workerCondition.notify_one();
+    m_workerThread.join();
+}
+
+void MidiOut::workerThread()
+{
+    realtime::setupCurrentThread("MIDI output worker");
+    QueuedMidiMessage queued;
+    for (;;) {
+        while (m_queue->pop(queued)) {
+            switch (queued.kind) {
+            case SINGLE:
+                sendNow(queued.message);
+                recordLatency(queued.message, queued.arrivalTime, chrono::steady_clock::now());
+                break;
+            case BLOCK_PART:
+                m_workerBlock.addEvent(queued.message, 0);
+                m_workerBlockArrivalTimes.push_back(queued.arrivalTime);
+                break;
+            case BLOCK_END:
+                m_workerBlock.addEvent(queued.message, 0);
+                m_workerBlockArrivalTimes.push_back(queued.arrivalTime);
+                sendBlockNow(m_workerBlock);
+                recordLatency(m_workerBlock, m_workerBlockArrivalTimes);
+                m_workerBlock.clear();
+                m_workerBlockArrivalTimes.clear();
+                break;
+            }
+        }
+
+        // Whatever was queued before the exit request has been sent by now
+        unique_lock<mutex> lock(m_workerMutex);
+        if (m_workerExit)
+            return;
+        m_workerWaiting.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        m_workerCondition.wait(lock, [this] { return m_workerExit || !m_queue->empty(); });
+        m_workerWaiting.store(false, memory_order_relaxed);
+    }
+}
+
+// Messages that don't come from OSC have no arrival time, and are not measured
+void MidiOut::recordLatency(const juce::MidiMessage& message, chrono::steady_clock::time_point arrivalTime, chrono::steady_clock::time_point now)
+{
+    if (arrivalTime == chrono::steady_clock::time_point() || message.getRawDataSize() == 0)
+        return;
+    m_latency[midi_status::getStatusSlot(message.getRawData()[0])].record(now - arrivalTime);
+}
+
+void MidiOut::recordLatency(const juce::MidiBuffer& messages, const ArrivalTimes& arrivalTimes)
+{
+    auto now = chrono::steady_clock::now();
+    MidiBuffer::Iterator it(messages);
+    MidiMessage message;
+    int samplePosition;
+    for (size_t i = 0; i < arrivalTimes.size() && it.getNextEvent(message, samplePosition); i++) {
+        recordLatency(message, arrivalTimes[i], now);
+    }
+}
+
+void MidiOut::setBuffered(bool buffered)
+{
+    if (!buffered) {
+        drain();
+    }
+    m_buffered = buffered;
+}
+
+void MidiOut::drain()
+{
+    if (m_pending.isEmpty()) {
+        return;
+    }
+    m_drainedEventCount += m_pending.getNumEvents();
+    m_drainCount++;
+    sendBlock(m_pending, m_pendingArrivalTimes);
+    // clear() keeps the allocated space for the next round
+    m_pending.clear();
+    m_pendingArrivalTimes.clear();
+}
+
+shared_ptr<const MidiDeviceList> MidiOut::scanOutputs()
+{
+    StringArray devices;
+    {
+        lock_guard<mutex> lock(m_juceClientMutex);
+        devices = MidiOutput::getDevices();
+    }
+    return MidiRegistry::getInstance().setDevices(MidiRegistry::Output, devices);
+}
+
+shared_ptr<const MidiDeviceList> MidiOut::getOutputList()
+{
+    auto outputList = MidiRegistry::getInstance().getDevices(MidiRegistry::Output);
+    if (outputList)
+        return outputList;
+    return scanOutputs();
+}
+
+vector<string> MidiOut::getOutputNames()
+{
+    return getOutputList()->names;
+}
+
+shared_ptr<const MidiDeviceList> MidiOut::getDeviceList() const
+{
+    return getOutputList();
+}
@@ -24,8 +24,19 @@
 
 #include <vector>
 #include <map>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include "midicommon.h"
+#include "spscring.h"
+#include "latencyhistogram.h"
+#include "midistatus.h"
 #include "../JuceLibraryCode/JuceHeader.h"
 
 // This class manages a MIDI output device as seen by JUCE
@@ -37,13 +48,87 @@ public:
 
     ~MidiOut();
 
-    void send(const juce::MidiMessage& message);
+    // arrivalTime, when given, is when the OSC that produced the messages arrived, for the latency stats
+    void send(const juce::MidiMessage& message, std::chrono::steady_clock::time_point arrivalTime = std::chrono::steady_clock::time_point());
+    // Sends a set of messages in one burst. On ALSA they are written with a single drain of the output buffer
+    void send(const juce::MidiBuffer& messages, std::chrono::steady_clock::time_point arrivalTime = std::chrono::steady_clock::time_point());
 
+    // In buffered mode the messages are held until drain() is called, and then they are all sent together
+    void setBuffered(bool buffered);
+    void drain();
+    uint64_t getDrainCount() const { return m_drainCount; }
+    uint64_t getDrainedEventCount() const { return m_drainedEventCount; }
+    // Blocks the device didn't take in time. The part that was not sent is dropped
+    uint64_t getFailedDrainCount() const { return m_failedDrainCount; }
+
+    // With a worker, the messages are queued and sent from a thread of this output, so encoding and queueing
+    // don't wait for the device. The writes of all the outputs still go one at a time through JUCE's ALSA client.
+    // Messages that don't fit in a full queue are dropped. Call it before sending anything.
+    // Either way, send() and drain() must not be called from more than one thread at a time
+    void startWorker(std::size_t queueSize);
+    bool hasWorker() const { return m_queue != nullptr; }
+    std::size_t getQueueDepth() const { return m_queue ? m_queue->size() : 0; }
+    std::size_t getMaxQueueDepth() const { return m_maxQueueDepth; }
+    uint64_t getQueueOverflows() const { return m_queueOverflows; }
+
+    // Time from the OSC arriving to its MIDI being sent to the device, for one status type, since the previous call
+    LatencySummary takeLatency(int statusSlot) { return m_latency[statusSlot].takeSummary(); }
+
+    // Enumerates the output devices once, and keeps the list for getOutputNames() and for the ports opened after it
+    static std::shared_ptr<const MidiDeviceList> scanOutputs();
+    // The names from the latest scan. Only scans if there was none yet
     static std::vector<std::string> getOutputNames();
 
 protected:
-    void updateMidiDevicesNamesMapping() override;
+    std::shared_ptr<const MidiDeviceList> getDeviceList() const override;
+    static std::shared_ptr<const MidiDeviceList> getOutputList();
 
 private:
+    // A block is queued as BLOCK_PART messages and a final BLOCK_END, and the worker sends it all together
+    enum QueuedKind { SINGLE, BLOCK_PART, BLOCK_END };
+    struct QueuedMidiMessage {
+        juce::MidiMessage message;
+        QueuedKind kind;
+        std::chrono::steady_clock::time_point arrivalTime;
+    };
+    // The arrival time of each message of a block, in the same order
+    typedef std::vector<std::chrono::steady_clock::time_point> ArrivalTimes;
+
+    void sendBlock(const juce::MidiBuffer& messages, const ArrivalTimes& arrivalTimes);
+    // Write to the device, holding m_juceClientMutex
+    void sendNow(const juce::MidiMessage& message);
+    bool sendBlockNow(const juce::MidiBuffer& messages);
+    bool queueMessage(const juce::MidiMessage& message, QueuedKind kind, std::chrono::steady_clock::time_point arrivalTime);
+    void recordLatency(const juce::MidiMessage& message, std::chrono::steady_clock::time_point arrivalTime, std::chrono::steady_clock::time_point now);
+    void recordLatency(const juce::MidiBuffer& messages, const ArrivalTimes& arrivalTimes);
+    void wakeWorker();
+    void workerThread();
+    void stopWorker();
+
+    // All the outputs go through JUCE's single ALSA client, which is not thread safe, and they are opened,
+    // written and closed from different threads (dispatch, workers, and the reconfiguration of the outputs)
+    static std::mutex m_juceClientMutex;
+
     MidiOutput* m_midiOut;
+    bool m_buffered;
+    juce::MidiBuffer m_pending;
+    ArrivalTimes m_pendingArrivalTimes;
+    ArrivalTimes m_blockArrivalTimes;
+    std::atomic<uint64_t> m_drainCount;
+    std::atomic<uint64_t> m_drainedEventCount;
+    std::atomic<uint64_t> m_failedDrainCount;
+
+    std::unique_ptr<SpscRing<QueuedMidiMessage> > m_queue;
+    std::atomic<std::size_t> m_maxQueueDepth;
+    std::atomic<uint64_t> m_queueOverflows;
+    // Set by the worker before it sleeps, so senders only take the mutex when there is someone to wake up
+    std::atomic<bool> m_workerWaiting;
+    bool m_workerExit;
+    std::mutex m_workerMutex;
+    std::condition_variable m_workerCondition;
+    std::thread m_workerThread;
+    juce::MidiBuffer m_workerBlock;
+    ArrivalTimes m_workerBlockArrivalTimes;
+
+    LatencyHistogram m_latency[midi_status::N_STATUS_SLOTS];
 };
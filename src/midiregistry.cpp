@@ -0,0 +1,87 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <mutex>
+#include "midiregistry.h"
+#include "utils.h"
+
+using namespace std;
+
+MidiDeviceList::MidiDeviceList(const juce::StringArray& devices)
+    : names(devices.size())
+{
+    nameToJuceMidiId.reserve(devices.size());
+    for (int i = 0; i < devices.size(); i++) {
+        names[i] = devices[i].toStdString();
+        nameToJuceMidiId[names[i]] = i;
+    }
+}
+
+int MidiDeviceList::getJuceMidiId(const string& portName) const
+{
+    return nameToJuceMidiId.at(portName);
+}
+
+const MidiPortName& MidiRegistry::intern(const string& portName)
+{
+    {
+        shared_lock<shared_timed_mutex> lock(m_mutex);
+        auto search = m_portNamesByName.find(portName);
+        if (search != m_portNamesByName.end())
+            return *search->second;
+    }
+
+    unique_lock<shared_timed_mutex> lock(m_mutex);
+    // Someone else may have added it while we were not holding the lock
+    auto search = m_portNamesByName.find(portName);
+    if (search != m_portNamesByName.end())
+        return *search->second;
+
+    string normalizedName = portName;
+    local_utils::safeOscString(normalizedName);
+    m_portNames.push_back(MidiPortName{ static_cast<unsigned int>(m_portNames.size()), portName, normalizedName });
+    const MidiPortName* interned = &m_portNames.back();
+    m_portNamesByName.emplace(portName, interned);
+    return *interned;
+}
+
+const MidiPortName* MidiRegistry::find(const string& portName) const
+{
+    shared_lock<shared_timed_mutex> lock(m_mutex);
+    auto search = m_portNamesByName.find(portName);
+    return (search != m_portNamesByName.end() ? search->second : nullptr);
+}
+
+shared_ptr<const MidiDeviceList> MidiRegistry::setDevices(Direction direction, const juce::StringArray& devices)
+{
+    // Built before taking the lock, readers only wait for the pointer swap
+    auto deviceList = make_shared<const MidiDeviceList>(devices);
+    unique_lock<shared_timed_mutex> lock(m_mutex);
+    m_devices[direction] = deviceList;
+    return deviceList;
+}
+
+shared_ptr<const MidiDeviceList> MidiRegistry::getDevices(Direction direction) const
+{
+    shared_lock<shared_timed_mutex> lock(m_mutex);
+    return m_devices[direction];
+}
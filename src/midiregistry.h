@@ -0,0 +1,85 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <memory>
+#include <deque>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <shared_mutex>
+#include "../JuceLibraryCode/JuceHeader.h"
+
+// A port name, interned by the registry. Its sticky id stays the same for as long as the program runs,
+// even if the device goes away and comes back
+struct MidiPortName {
+    unsigned int stickyId;
+    std::string name;
+    std::string normalizedName;
+};
+
+// The MIDI devices of one direction, as JUCE listed them in a single enumeration. The JUCE id of a device is its index in names
+struct MidiDeviceList {
+    MidiDeviceList() {}
+    explicit MidiDeviceList(const juce::StringArray& devices);
+
+    // Throws std::out_of_range if the device was not there when the list was taken
+    int getJuceMidiId(const std::string& portName) const;
+
+    std::vector<std::string> names;
+    std::unordered_map<std::string, int> nameToJuceMidiId;
+};
+
+// Keeps the interned port names and the latest device list of each direction, shared by MidiIn and MidiOut
+// Lookups can run concurrently, only interning a new name or publishing a new device list takes the lock exclusively
+class MidiRegistry {
+public:
+    enum Direction { Input = 0, Output = 1 };
+
+    MidiRegistry(const MidiRegistry&) = delete;
+    MidiRegistry& operator=(const MidiRegistry&) = delete;
+
+    static MidiRegistry& getInstance()
+    {
+        static MidiRegistry instance;
+        return instance;
+    }
+
+    // Gives the name a sticky id the first time it is seen. The returned reference is valid until the program ends
+    const MidiPortName& intern(const std::string& portName);
+    // nullptr if the name was never interned
+    const MidiPortName* find(const std::string& portName) const;
+
+    std::shared_ptr<const MidiDeviceList> setDevices(Direction direction, const juce::StringArray& devices);
+    // nullptr if the devices of that direction were never listed
+    std::shared_ptr<const MidiDeviceList> getDevices(Direction direction) const;
+
+private:
+    MidiRegistry() {}
+
+    mutable std::shared_timed_mutex m_mutex;
+    // A deque, so the interned names never move
+    std::deque<MidiPortName> m_portNames;
+    std::unordered_map<std::string, const MidiPortName*> m_portNamesByName;
+    std::shared_ptr<const MidiDeviceList> m_devices[2];
+};
@@ -0,0 +1,66 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "midistatus.h"
+
+namespace midi_status {
+void encodeDataBytes(osc::OutboundPacketStream& p, const uint8_t* message, int nBytes)
+{
+    for (int i = 1; i < nBytes; i++) {
+        p << (int)message[i];
+    }
+}
+
+// We treat the pitch bend differently. Instead of sending the bytes separately,
+// we send the processed 14 bits value
+void encodePitchBend(osc::OutboundPacketStream& p, const uint8_t* message, int nBytes)
+{
+    p << (int)(message[1] | (message[2] << 7));
+}
+
+// Skip the end of message marker
+void encodeSysex(osc::OutboundPacketStream& p, const uint8_t* message, int nBytes)
+{
+    encodeDataBytes(p, message, nBytes - 1);
+}
+
+bool isWellFormed(int statusSlot, const uint8_t* message, int nBytes)
+{
+    if (nBytes <= 0)
+        return false;
+
+    const StatusInfo& info = getStatusInfo(statusSlot);
+    if (info.encode == encodeSysex) {
+        if (nBytes < 2 || message[nBytes - 1] != 0xf7)
+            return false;
+        nBytes--;
+    } else if (info.expectedLength != 0 && nBytes != info.expectedLength) {
+        return false;
+    }
+
+    for (int i = 1; i < nBytes; i++) {
+        if (message[i] & 0x80)
+            return false;
+    }
+    return true;
+}
+}
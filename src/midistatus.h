@@ -0,0 +1,95 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "osc/OscOutboundPacketStream.h"
+
+// Decoding information for every MIDI status byte, shared by the m2o decoder and the validation of incoming messages.
+// Status bytes 0x80-0xef are mapped to slots 0-6 (channel messages), 0xf0-0xff to slots 7-22, and anything else to 23
+namespace midi_status {
+
+// Writes the decoded (non raw) OSC arguments for a MIDI message
+typedef void (*ArgEncoder)(osc::OutboundPacketStream& p, const uint8_t* message, int nBytes);
+
+void encodeDataBytes(osc::OutboundPacketStream& p, const uint8_t* message, int nBytes);
+void encodePitchBend(osc::OutboundPacketStream& p, const uint8_t* message, int nBytes);
+void encodeSysex(osc::OutboundPacketStream& p, const uint8_t* message, int nBytes);
+
+struct StatusInfo {
+    const char* name;
+    int expectedLength; // 0 for variable or unknown length
+    ArgEncoder encode;
+};
+
+constexpr StatusInfo makeStatusInfo(const char* name, int expectedLength, ArgEncoder encode)
+{
+    return StatusInfo{ name, expectedLength, encode };
+}
+
+const int N_CHANNEL_SLOTS = 17; // 0 is used for messages without a channel
+const int N_STATUS_SLOTS = 24;
+const int N_CHANNEL_STATUS_SLOTS = 7;
+
+constexpr StatusInfo statusTable[N_STATUS_SLOTS] = {
+    makeStatusInfo("note_off", 3, encodeDataBytes),
+    makeStatusInfo("note_on", 3, encodeDataBytes),
+    makeStatusInfo("polyphonic_key_pressure", 3, encodeDataBytes),
+    makeStatusInfo("control_change", 3, encodeDataBytes),
+    makeStatusInfo("program_change", 2, encodeDataBytes),
+    makeStatusInfo("channel_pressure", 2, encodeDataBytes),
+    makeStatusInfo("pitch_bend", 3, encodePitchBend),
+    makeStatusInfo("sysex", 0, encodeSysex),
+    makeStatusInfo("MTC", 2, encodeDataBytes),
+    makeStatusInfo("song_position", 3, encodeDataBytes),
+    makeStatusInfo("song_select", 2, encodeDataBytes),
+    makeStatusInfo("syscommon_undefined", 1, encodeDataBytes),
+    makeStatusInfo("syscommon_undefined", 1, encodeDataBytes),
+    makeStatusInfo("tune_request", 1, encodeDataBytes),
+    makeStatusInfo("unknown_message", 0, encodeDataBytes), // 0xf7, end of sysex on its own
+    makeStatusInfo("clock", 1, encodeDataBytes),
+    makeStatusInfo("sysrt_undefined", 1, encodeDataBytes),
+    makeStatusInfo("start", 1, encodeDataBytes),
+    makeStatusInfo("continue", 1, encodeDataBytes),
+    makeStatusInfo("stop", 1, encodeDataBytes),
+    makeStatusInfo("sysrt_undefined", 1, encodeDataBytes),
+    makeStatusInfo("active_sensing", 1, encodeDataBytes),
+    makeStatusInfo("unknown_message", 1, encodeDataBytes), // 0xff, system reset
+    makeStatusInfo("unknown_message", 0, encodeDataBytes) // not a status byte
+};
+
+// status is the first byte of the message, with the channel bits removed for channel messages
+constexpr int getStatusSlot(uint8_t status)
+{
+    return (status >= 0xf0 ? N_CHANNEL_STATUS_SLOTS + (status - 0xf0) : (status >= 0x80 ? (status >> 4) - 8 : N_STATUS_SLOTS - 1));
+}
+
+constexpr const StatusInfo& getStatusInfo(int statusSlot)
+{
+    return statusTable[statusSlot];
+}
+
+// Checks the length and data bytes of a message against what its status byte says it should be
+bool isWellFormed(int statusSlot, const uint8_t* message, int nBytes);
+}
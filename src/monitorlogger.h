@@ -2,10 +2,32 @@
 
 #include <iostream>
 #include <memory>
+#include <atomic>
 #include "oscout.h"
 #include "spdlog/spdlog.h"
 #include "osc_sink.h"
 
+// Log calls below this level (0: trace ... 6: off) are compiled out. Set from cmake with OSMID_MIN_LOG_LEVEL
+#ifndef OSMID_MIN_LOG_LEVEL
+#define OSMID_MIN_LOG_LEVEL 0
+#endif
+
+// Use these instead of calling the logger methods directly: when the level is compiled out the
+// arguments are not evaluated either (no string copies or lookups just to build a log line)
+#define OSMID_LOG(logger, level, method, ...)          \
+    do {                                               \
+        if (MonitorLogger::isCompiledIn(level)) {      \
+            (logger).method(__VA_ARGS__);              \
+        }                                              \
+    } while (0)
+
+#define OSMID_LOG_TRACE(logger, ...) OSMID_LOG(logger, spdlog::level::trace, trace, __VA_ARGS__)
+#define OSMID_LOG_DEBUG(logger, ...) OSMID_LOG(logger, spdlog::level::debug, debug, __VA_ARGS__)
+#define OSMID_LOG_INFO(logger, ...) OSMID_LOG(logger, spdlog::level::info, info, __VA_ARGS__)
+#define OSMID_LOG_WARN(logger, ...) OSMID_LOG(logger, spdlog::level::warn, warn, __VA_ARGS__)
+#define OSMID_LOG_ERROR(logger, ...) OSMID_LOG(logger, spdlog::level::err, error, __VA_ARGS__)
+#define OSMID_LOG_CRITICAL(logger, ...) OSMID_LOG(logger, spdlog::level::critical, critical, __VA_ARGS__)
+
 class MonitorLogger {
 public:
     MonitorLogger(MonitorLogger const&) = delete;
@@ -19,6 +41,9 @@ public:
 
     void setLogLevel(int level) { spdlog::set_level(static_cast<spdlog::level::level_enum>(level)); }
     void setSendToOSC(bool send) { m_sendToOSC = send; }
+    static constexpr bool isCompiledIn(spdlog::level::level_enum level) { return level >= OSMID_MIN_LOG_LEVEL; }
+    // Cheap check to skip whole logging loops when the level is off
+    bool shouldLog(spdlog::level::level_enum level) const { return isCompiledIn(level) && m_console->should_log(level); }
     void setOscOutput(std::shared_ptr<OscOutput> oscOutput)
     {
         m_osc = spdlog::create<spdlog::sinks::osc_sink_mt>("osc", oscOutput);
@@ -27,65 +52,80 @@ public:
     template <typename... Args>
     inline void trace(const char* fmt, const Args&... args)
     {
-        m_console->trace(fmt, args...);
-        if (m_sendToOSC) {
-            m_osc->trace(fmt, args...);
+        if (isCompiledIn(spdlog::level::trace)) {
+            log(spdlog::level::trace, fmt, args...);
         }
     }
 
     template <typename... Args>
     inline void debug(const char* fmt, const Args&... args)
     {
-        m_console->debug(fmt, args...);
-        if (m_sendToOSC) {
-            m_osc->debug(fmt, args...);
+        if (isCompiledIn(spdlog::level::debug)) {
+            log(spdlog::level::debug, fmt, args...);
         }
     }
 
     template <typename... Args>
     inline void info(const char* fmt, const Args&... args)
     {
-        m_console->info(fmt, args...);
-        if (m_sendToOSC) {
-            m_osc->info(fmt, args...);
+        if (isCompiledIn(spdlog::level::info)) {
+            log(spdlog::level::info, fmt, args...);
         }
     }
 
     template <typename... Args>
     inline void warn(const char* fmt, const Args&... args)
     {
-        m_console->warn(fmt, args...);
-        if (m_sendToOSC) {
-            m_osc->warn(fmt, args...);
+        if (isCompiledIn(spdlog::level::warn)) {
+            log(spdlog::level::warn, fmt, args...);
         }
     }
 
     template <typename... Args>
     inline void error(const char* fmt, const Args&... args)
     {
-        m_console->error(fmt, args...);
-        if (m_sendToOSC) {
-            m_osc->error(fmt, args...);
+        if (isCompiledIn(spdlog::level::err)) {
+            log(spdlog::level::err, fmt, args...);
         }
     }
 
     template <typename... Args>
     inline void critical(const char* fmt, const Args&... args)
     {
-        m_console->critical(fmt, args...);
-        if (m_sendToOSC) {
-            m_osc->critical(fmt, args...);
+        if (isCompiledIn(spdlog::level::critical)) {
+            log(spdlog::level::critical, fmt, args...);
         }
     }
 
 private:
+    // Must be a power of 2
+    static const size_t LOG_QUEUE_SIZE = 8192;
+
     MonitorLogger()
     {
         m_sendToOSC = true;
+        // Log records are pushed into spdlog's bounded lock free queue, and a background thread applies the
+        // pattern and writes them to the console and to OSC. If the queue is full the record is dropped.
+        // Note that the message text itself is still formatted (and copied into the record, which allocates)
+        // on the calling thread, so logging from the MIDI <-> OSC paths must stay behind shouldLog()
+        spdlog::set_async_mode(LOG_QUEUE_SIZE, spdlog::async_overflow_policy::discard_log_msg);
         m_console = spdlog::stdout_logger_mt("console");
     }
 
+    template <typename... Args>
+    inline void log(spdlog::level::level_enum level, const char* fmt, const Args&... args)
+    {
+        // Check the level before anything gets formatted
+        if (!m_console->should_log(level)) {
+            return;
+        }
+        m_console->log(level, fmt, args...);
+        if (m_sendToOSC && m_osc) {
+            m_osc->log(level, fmt, args...);
+        }
+    }
+
     std::shared_ptr<spdlog::logger> m_console;
     std::shared_ptr<spdlog::logger> m_osc;
-    bool m_sendToOSC;
+    std::atomic<bool> m_sendToOSC;
 };
@@ -26,6 +26,7 @@
 #include <mutex>
 #include <iostream>
 #include <atomic>
+#include <algorithm>
 #include "cxxopts.hpp"
 #include "midiout.h"
 #include "oscin.h"
@@ -34,7 +35,11 @@
 #include "osc/OscOutboundPacketStream.h"
 #include "version.h"
 #include "utils.h"
+#include "realtime.h"
 #include "monitorlogger.h"
+#if OSMID_ALSA
+#include "alsadevicewatcher.h"
+#endif
 
 using namespace std;
 
@@ -55,8 +60,13 @@ struct ProgramOptions {
     unsigned int oscOutputPort;
     bool oscHeartbeat;
     unsigned int monitor;
+    unsigned int rtPriority;
+    vector<int> cpus;
+    bool lockMemory;
     bool listPorts;
     bool oscLocal;
+    bool bufferedOutput;
+    unsigned int queueSize;
 };
 
 void showVersion()
@@ -81,8 +91,13 @@ int setup_and_parse_program_options(int argc, char* argv[], ProgramOptions& prog
     ("i,oscport", "OSC Input port", cxxopts::value<unsigned int>(programOptions.oscInputPort)->default_value("57200"))
     ("L,local", "OSC listen only on the local network interface", cxxopts::value<bool>(programOptions.oscLocal))
     ("b,heartbeat", "OSC send the heartbeat with info about the active MIDI devices", cxxopts::value<bool>(programOptions.oscHeartbeat))
+    ("queuesize", "Send to each MIDI output from its own thread, fed by a queue of this many messages, so the OSC receive thread doesn't wait for the devices (0: send from the OSC receive thread)", cxxopts::value<unsigned int>(programOptions.queueSize)->default_value("0"))
+    ("buffered", "Send the MIDI events of each OSC packet or bundle together, with a single flush of the output", cxxopts::value<bool>(programOptions.bufferedOutput))
     ("H,oscoutputhost", "OSC Output host. Used for heartbeat", cxxopts::value<string>(programOptions.oscOutputHost)->default_value("127.0.0.1"))
     ("O,oscoutputport", "OSC Output port. Used for heartbeat", cxxopts::value<unsigned int>(programOptions.oscOutputPort)->default_value("57120"))
+    ("rtpriority", "Run the threads that handle MIDI and OSC with SCHED_FIFO at this priority, 1-99 (0: normal scheduling)", cxxopts::value<unsigned int>(programOptions.rtPriority)->default_value("0"))
+    ("cpu", "Pin the threads that handle MIDI and OSC to this CPU - can be specified multiple times", cxxopts::value<vector<int> >(programOptions.cpus))
+    ("mlock", "Lock the process memory, so page faults don't cause latency spikes", cxxopts::value<bool>(programOptions.lockMemory))
     ("m,monitor", "Monitor and logging level (lower more verbose)", cxxopts::value<unsigned int>(programOptions.monitor)->default_value("2")->implicit_value("1"))
     ("h,help", "Display this help message")
     ("version", "Show the version number");
@@ -106,11 +121,13 @@ int setup_and_parse_program_options(int argc, char* argv[], ProgramOptions& prog
 
     programOptions.oscLocal = (options.count("local") ? true : false);
     programOptions.oscHeartbeat = (options.count("heartbeat") ? true : false);
+    programOptions.bufferedOutput = (options.count("buffered") ? true : false);
     programOptions.listPorts = (options.count("list") ? true : false);
+    programOptions.lockMemory = (options.count("mlock") ? true : false);
 
     if (!options.count("midiout")) {
         // by default add all input devices
-        programOptions.midiOutputNames = MidiOut::getOutputNames();
+        programOptions.midiOutputNames = MidiOut::scanOutputs()->names;
         programOptions.allMidiOutputs = true;
     } else {
         programOptions.allMidiOutputs = false;
@@ -119,25 +136,35 @@ int setup_and_parse_program_options(int argc, char* argv[], ProgramOptions& prog
     return 0;
 }
 
-static mutex g_oscinMutex;
-
-void prepareOscProcessorOutputs(unique_ptr<OscInProcessor>& oscInputProcessor, const ProgramOptions& popts)
+void prepareOscProcessorOutputs(unique_ptr<OscInProcessor>& oscInputProcessor, const ProgramOptions& popts, const vector<string>& removedPorts = vector<string>())
 {
     // Should we open all devices, or just the ones passed as parameters?
     vector<string> midiOutputsToOpen = (popts.allMidiOutputs ? MidiOut::getOutputNames() : popts.midiOutputNames);
-    {
-        lock_guard<mutex> lock(g_oscinMutex);
-        oscInputProcessor->prepareOutputs(midiOutputsToOpen);
-    }
+    // Safe to do while the OSC input keeps running, the processor publishes the new set of outputs without stopping it.
+    // Ports that were removed and are back need reopening
+    oscInputProcessor->prepareOutputs(midiOutputsToOpen, removedPorts);
 }
 
 static std::atomic<bool> g_wantToExit(false);
+#if OSMID_ALSA
+static AlsaDeviceWatcher* g_deviceWatcher = nullptr;
+#endif
+
+// Makes the main loop finish, also when it is waiting for device changes
+static void requestExit()
+{
+    g_wantToExit = true;
+#if OSMID_ALSA
+    if (g_deviceWatcher)
+        g_deviceWatcher->interrupt();
+#endif
+}
 
 #if WIN32
 BOOL ctrlHandler(DWORD fdwCtrlType)
 {
     if (fdwCtrlType == CTRL_C_EVENT) {
-        g_wantToExit = true;
+        requestExit();
     }
     return TRUE;
 }
@@ -145,40 +172,81 @@ BOOL ctrlHandler(DWORD fdwCtrlType)
 void ctrlHandler(int signal)
 {
     cout << "Ctrl-C event" << endl;
-    g_wantToExit = true;
+    requestExit();
 }
 #endif
 
-void asyncBreakThread(OscInProcessor* oscInputProcessor)
+void sendHeartBeat(const OscInProcessor& oscInputProcessor, OscOutput& oscOutput)
 {
-    while (!g_wantToExit) {
-        std::chrono::milliseconds timespan(1000);
-        std::this_thread::sleep_for(timespan);
-        {
-            lock_guard<mutex> lock(g_oscinMutex);
-            oscInputProcessor->asyncBreak();
-        }
+    char buffer[2048];
+    osc::OutboundPacketStream p(buffer, 2048);
+    p << osc::BeginMessage("/o2m/heartbeat");
+    for (int i = 0; i < oscInputProcessor.getNMidiOuts(); i++) {
+      p << oscInputProcessor.getMidiOutId(i) << oscInputProcessor.getMidiOutName(i).c_str() << oscInputProcessor.getNormalizedMidiOutName(i).c_str();
+    }
+    p << osc::EndMessage;
+    OSMID_LOG_DEBUG(MonitorLogger::getInstance(), "sending OSC: [/o2m/heartbeat] -> ");
+    for (int i = 0; i < oscInputProcessor.getNMidiOuts(); i++) {
+        OSMID_LOG_DEBUG(MonitorLogger::getInstance(), "   {}, {}", oscInputProcessor.getMidiOutId(i), oscInputProcessor.getMidiOutName(i));
     }
+
+    oscOutput.sendUDP(p.Data(), p.Size());
+    local_utils::logOSCMessage(p.Data(), p.Size());
 }
 
-void sendHeartBeat(const OscInProcessor& oscInputProcessor, OscOutput& oscOutput)
+void sendBufferingStats(const OscInProcessor& oscInputProcessor, OscOutput& oscOutput)
 {
     char buffer[2048];
     osc::OutboundPacketStream p(buffer, 2048);
-    p << osc::BeginMessage("/o2m/heartbeat");
+    p << osc::BeginMessage("/o2m/midi_buffering");
     for (int i = 0; i < oscInputProcessor.getNMidiOuts(); i++) {
-      p << oscInputProcessor.getMidiOutId(i) << oscInputProcessor.getMidiOutName(i).c_str() << oscInputProcessor.getNormalizedMidiOutName(i).c_str();
+        uint64_t events = oscInputProcessor.getMidiOutDrainedEventCount(i);
+        uint64_t drains = oscInputProcessor.getMidiOutDrainCount(i);
+        uint64_t failedDrains = oscInputProcessor.getMidiOutFailedDrainCount(i);
+        p << oscInputProcessor.getMidiOutId(i) << (osc::int64)events << (osc::int64)drains << (drains > 0 ? (float)events / drains : 0.0f) << (osc::int64)failedDrains;
     }
     p << osc::EndMessage;
-    MonitorLogger::getInstance().debug("sending OSC: [/o2m/heartbeat] -> ");
+
+    oscOutput.sendUDP(p.Data(), p.Size());
+    local_utils::logOSCMessage(p.Data(), p.Size());
+}
+
+// Reports, for every MIDI output with its own thread, how full its queue is, the most it has been, and how many messages it had to drop
+void sendQueueStats(const OscInProcessor& oscInputProcessor, OscOutput& oscOutput)
+{
+    char buffer[2048];
+    osc::OutboundPacketStream p(buffer, 2048);
+    p << osc::BeginMessage("/o2m/output_queues");
     for (int i = 0; i < oscInputProcessor.getNMidiOuts(); i++) {
-        MonitorLogger::getInstance().debug("   {}, {}", oscInputProcessor.getMidiOutId(i), oscInputProcessor.getMidiOutName(i));
+        p << oscInputProcessor.getMidiOutId(i) << (int)oscInputProcessor.getMidiOutQueueDepth(i) << (int)oscInputProcessor.getMidiOutMaxQueueDepth(i) << (osc::int64)oscInputProcessor.getMidiOutQueueOverflows(i);
     }
+    p << osc::EndMessage;
 
     oscOutput.sendUDP(p.Data(), p.Size());
     local_utils::logOSCMessage(p.Data(), p.Size());
 }
 
+// Reports, for every MIDI output and type of message, how long the messages took from the OSC arriving to the MIDI being sent, since the previous report
+void sendLatencyStats(OscInProcessor& oscInputProcessor, OscOutput& oscOutput)
+{
+    // One message per output, 24 message types don't leave room for more
+    for (int i = 0; i < oscInputProcessor.getNMidiOuts(); i++) {
+        char buffer[2048];
+        osc::OutboundPacketStream p(buffer, 2048);
+        p << osc::BeginMessage("/o2m/stats") << oscInputProcessor.getMidiOutId(i);
+        for (int statusSlot = 0; statusSlot < midi_status::N_STATUS_SLOTS; statusSlot++) {
+            LatencySummary latency = oscInputProcessor.takeMidiOutLatency(i, statusSlot);
+            if (latency.count == 0)
+                continue;
+            p << midi_status::getStatusInfo(statusSlot).name << (osc::int64)latency.count << latency.p50 << latency.p99 << latency.p999 << latency.max;
+        }
+        p << osc::EndMessage;
+
+        oscOutput.sendUDP(p.Data(), p.Size());
+        local_utils::logOSCMessage(p.Data(), p.Size());
+    }
+}
+
 int main(int argc, char* argv[])
 {
     try {
@@ -197,11 +265,18 @@ int main(int argc, char* argv[])
 
         MonitorLogger::getInstance().setLogLevel(popts.monitor);
 
+        // Before any of the threads that handle MIDI and OSC start
+        realtime::setThreadOptions(static_cast<int>(popts.rtPriority), popts.cpus);
+        if (popts.lockMemory)
+            realtime::lockMemory();
+
         // Open the OSC output port, for heartbeats and logging
         oscOutput = make_shared<OscOutput>(popts.oscOutputHost, popts.oscOutputPort);
         MonitorLogger::getInstance().setOscOutput(oscOutput);
 
         auto oscInputProcessor = make_unique<OscInProcessor>(popts.oscLocal, popts.oscInputPort);
+        oscInputProcessor->setBufferedOutput(popts.bufferedOutput);
+        oscInputProcessor->setOutputWorkers(popts.queueSize);
         try {
             // Prepare the OSC input and MIDI outputs
             prepareOscProcessorOutputs(oscInputProcessor, popts);
@@ -222,23 +297,84 @@ int main(int argc, char* argv[])
         sigaction(SIGINT, &intHandler, NULL);
     #endif
 
-        std::thread thr(asyncBreakThread, oscInputProcessor.get());
-
-        // For hotplugging
+        // The OSC input runs undisturbed on its own thread until we exit.
+        // This thread looks after the device changes and the heartbeat
+        std::atomic<bool> receiveDone(false);
+        std::atomic<bool> receiveFailed(false);
+        std::thread receiveThread([&oscInputProcessor, &receiveDone, &receiveFailed]() {
+            realtime::setupCurrentThread("OSC receive");
+            // An exception escaping the thread would terminate the program, so stop it the normal way instead
+            try {
+                oscInputProcessor->run();
+            } catch (const std::exception& e) {
+                cout << "Error receiving OSC: " << e.what() << endl;
+                receiveFailed = true;
+                requestExit();
+            }
+            receiveDone = true;
+        });
+
+        // For hotplugging. On Linux we are told about the changes by the ALSA sequencer, otherwise we check every second
+#if OSMID_ALSA
+        unique_ptr<AlsaDeviceWatcher> deviceWatcher = make_unique<AlsaDeviceWatcher>("o2m_watcher", false);
+        if (deviceWatcher->isValid())
+            g_deviceWatcher = deviceWatcher.get();
+#endif
+        const std::chrono::milliseconds heartbeatPeriod(1000);
+        auto nextHeartbeat = std::chrono::steady_clock::now() + heartbeatPeriod;
         vector<string> lastAvailablePorts = MidiOut::getOutputNames();
         while (!g_wantToExit) {
-            oscInputProcessor->run(); // will run until asyncBreak is called from another thread
-            vector<string> newAvailablePorts = MidiOut::getOutputNames();
-            // Was something added or removed?
-            if (newAvailablePorts != lastAvailablePorts) {
-                prepareOscProcessorOutputs(oscInputProcessor, popts);
-                lastAvailablePorts = newAvailablePorts;
+            bool changed = false;
+            vector<string> removedPorts;
+#if OSMID_ALSA
+            if (g_deviceWatcher) {
+                // Without a heartbeat there is nothing to do until something changes
+                int timeoutMs = -1;
+                if (popts.oscHeartbeat) {
+                    auto untilHeartbeat = std::chrono::duration_cast<std::chrono::milliseconds>(nextHeartbeat - std::chrono::steady_clock::now());
+                    timeoutMs = static_cast<int>(max<long long>(untilHeartbeat.count(), 0));
+                }
+                changed = g_deviceWatcher->waitForChanges(timeoutMs, removedPorts);
+                if (changed)
+                    MidiOut::scanOutputs();
+            } else
+#endif
+            {
+                std::this_thread::sleep_until(nextHeartbeat);
+                // Was something added or removed?
+                changed = (MidiOut::scanOutputs()->names != lastAvailablePorts);
+            }
+
+            if (changed && !g_wantToExit) {
+                prepareOscProcessorOutputs(oscInputProcessor, popts, removedPorts);
+                lastAvailablePorts = MidiOut::getOutputNames();
                 listAvailablePorts();
             }
-            if (popts.oscHeartbeat)
-                sendHeartBeat(*oscInputProcessor, *oscOutput);
+
+            auto now = std::chrono::steady_clock::now();
+            if (now >= nextHeartbeat) {
+                nextHeartbeat = max(nextHeartbeat + heartbeatPeriod, now);
+                if (popts.oscHeartbeat) {
+                    sendHeartBeat(*oscInputProcessor, *oscOutput);
+                    if (oscInputProcessor->isBufferedOutput())
+                        sendBufferingStats(*oscInputProcessor, *oscOutput);
+                    if (oscInputProcessor->hasOutputWorkers())
+                        sendQueueStats(*oscInputProcessor, *oscOutput);
+                    sendLatencyStats(*oscInputProcessor, *oscOutput);
+                }
+            }
         }
-        thr.join();
+#if OSMID_ALSA
+        g_deviceWatcher = nullptr;
+#endif
+        // A break that arrives before the receive loop got going is lost, so keep trying until it stops
+        while (!receiveDone) {
+            oscInputProcessor->asyncBreak();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        receiveThread.join();
+        if (receiveFailed)
+            return -1;
     }
     catch (const std::exception& e) {
         cout << "General application error: " << e.what() << endl;
@@ -34,7 +34,7 @@ namespace sinks {
             p << osc::BeginMessage("/logging");
             p << msg.formatted.c_str();
             p << osc::EndMessage;
-            m_oscOutput->sendUDP(p.Data(), p.Size());
+            m_oscOutput->sendUDPNow(p.Data(), p.Size());
         }
 
         std::shared_ptr<OscOutput> m_oscOutput;
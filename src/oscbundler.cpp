@@ -0,0 +1,85 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "oscbundler.h"
+#include "realtime.h"
+#include "utils.h"
+
+using namespace std;
+
+OscBundler::OscBundler(const vector<shared_ptr<OscOutput> >& outputs, chrono::microseconds window)
+    : m_outputs(outputs),
+      m_window(window),
+      m_stream(m_buffer, MAX_BUNDLE_SIZE),
+      m_nMessages(0),
+      m_exit(false)
+{
+    m_thread = thread(&OscBundler::flushThread, this);
+}
+
+OscBundler::~OscBundler()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+    flush();
+}
+
+void OscBundler::flush()
+{
+    lock_guard<mutex> lock(m_mutex);
+    flushLocked();
+}
+
+void OscBundler::flushLocked()
+{
+    if (m_nMessages == 0)
+        return;
+
+    m_stream << osc::EndBundle;
+    for (auto& output : m_outputs) {
+        // A bundle is a burst on its own, don't leave it waiting for more packets to batch
+        output->sendUDPNow(m_stream.Data(), m_stream.Size());
+        local_utils::logOSCMessage(m_stream.Data(), m_stream.Size());
+    }
+    m_nMessages = 0;
+}
+
+// Sends the current bundle once its window has expired
+void OscBundler::flushThread()
+{
+    realtime::setupCurrentThread("OSC bundler");
+    unique_lock<mutex> lock(m_mutex);
+    while (!m_exit) {
+        if (m_nMessages == 0) {
+            m_condition.wait(lock);
+            continue;
+        }
+        m_condition.wait_until(lock, m_deadline);
+        if (m_nMessages > 0 && chrono::steady_clock::now() >= m_deadline) {
+            flushLocked();
+        }
+    }
+}
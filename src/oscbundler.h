@@ -0,0 +1,81 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include "osc/OscOutboundPacketStream.h"
+#include "oscout.h"
+
+// Groups the OSC messages produced within a time window into a single OSC bundle, timetagged with
+// the receive time of the first message, and sends it to every output
+class OscBundler {
+public:
+    OscBundler(const std::vector<std::shared_ptr<OscOutput> >& outputs, std::chrono::microseconds window);
+    OscBundler(const OscBundler&) = delete;
+    OscBundler& operator=(const OscBundler&) = delete;
+    ~OscBundler();
+
+    // encode is called with the bundle stream, and must write one complete message into it
+    template <typename Encoder>
+    void addMessage(std::uint64_t timeTag, Encoder encode)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Make sure that the biggest message we produce fits
+        if (m_nMessages > 0 && m_stream.Capacity() - m_stream.Size() < MAX_MESSAGE_SIZE) {
+            flushLocked();
+        }
+        if (m_nMessages == 0) {
+            m_stream.Clear();
+            m_stream << osc::BeginBundle(timeTag);
+            m_deadline = std::chrono::steady_clock::now() + m_window;
+            m_condition.notify_one();
+        }
+        encode(m_stream);
+        m_nMessages++;
+    }
+
+    void flush();
+
+private:
+    void flushLocked();
+    void flushThread();
+
+    static const std::size_t MAX_MESSAGE_SIZE = 1024;
+    static const std::size_t MAX_BUNDLE_SIZE = 8192;
+
+    std::vector<std::shared_ptr<OscOutput> > m_outputs;
+    std::chrono::microseconds m_window;
+    char m_buffer[MAX_BUNDLE_SIZE];
+    osc::OutboundPacketStream m_stream;
+    int m_nMessages;
+    std::chrono::steady_clock::time_point m_deadline;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::thread m_thread;
+    bool m_exit;
+};
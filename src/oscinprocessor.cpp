@@ -20,7 +20,10 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
-#include <regex>
+#include <chrono>
+#include <array>
+#include <cstring>
+#include <algorithm>
 #include "oscinprocessor.h"
 #include "utils.h"
 
@@ -28,119 +31,326 @@ using namespace std;
 using namespace juce;
 
 OscInProcessor::OscInProcessor(bool local, int oscListenPort)
+    : m_dispatchOutputs(nullptr),
+      m_bufferedOutput(false),
+      m_outputQueueSize(0)
 {
+    m_scheduler = make_unique<OscScheduler>([this](const osc::ReceivedMessage& message) { withOutputs(chrono::steady_clock::now(), [&]() { dispatchMessage(message); }); },
+        [this]() { withOutputs(chrono::steady_clock::now(), [&]() { drainOutputs(); }); });
     m_input = make_unique<OscIn>(local, oscListenPort, this);
 }
 
-void OscInProcessor::prepareOutputs(const vector<string>& outputNames)
+void OscInProcessor::prepareOutputs(const vector<string>& outputNames, const vector<string>& reopenNames)
 {
-    m_outputs.clear();
-    for (auto& outputName : outputNames) {
-        auto midiOut = make_unique<MidiOut>(outputName);
-        m_outputs.push_back(std::move(midiOut));
+    lock_guard<mutex> configLock(m_configMutex);
+    auto next = make_unique<OutputSet>();
+    {
+        auto current = m_outputSet.read();
+        for (auto& outputName : outputNames) {
+            shared_ptr<MidiOut> output;
+            if (find(reopenNames.begin(), reopenNames.end(), outputName) == reopenNames.end()) {
+                for (auto& open : current->outputs) {
+                    if (open->getPortName() == outputName) {
+                        output = open;
+                        break;
+                    }
+                }
+            }
+            if (!output) {
+                output = make_shared<MidiOut>(outputName);
+                output->setBuffered(m_bufferedOutput);
+                output->startWorker(m_outputQueueSize);
+            }
+            next->add(output);
+        }
+    }
+
+    // The outputs that are not in the new set are closed when no message is using them anymore
+    m_outputSet.publish(std::move(next));
+}
+
+void OscInProcessor::OutputSet::add(const shared_ptr<MidiOut>& output)
+{
+    outputs.push_back(output);
+
+    // If two devices normalize to the same name, the first one wins, as it used to with the linear search
+    const string& name = output->getNormalizedPortName();
+    if (findByName(name.c_str()) == nullptr) {
+        byName.emplace(local_utils::hashName(name.c_str()), output.get());
+    }
+    all.push_back(output.get());
+
+    // sticky ids are small and dense, since they are never reused
+    int id = output->getPortId();
+    if (id >= static_cast<int>(byId.size())) {
+        byId.resize(id + 1, nullptr);
+    }
+    byId[id] = output.get();
+}
+
+void OscInProcessor::setBufferedOutput(bool buffered)
+{
+    lock_guard<mutex> configLock(m_configMutex);
+    lock_guard<mutex> lock(m_dispatchMutex);
+    m_bufferedOutput = buffered;
+    auto outputs = m_outputSet.read();
+    for (auto& output : outputs->outputs) {
+        output->setBuffered(buffered);
+    }
+}
+
+void OscInProcessor::setOutputWorkers(size_t queueSize)
+{
+    // With the dispatch lock held nothing is sending, which is what starting a worker needs
+    lock_guard<mutex> configLock(m_configMutex);
+    lock_guard<mutex> lock(m_dispatchMutex);
+    m_outputQueueSize = queueSize;
+    auto outputs = m_outputSet.read();
+    for (auto& output : outputs->outputs) {
+        output->startWorker(queueSize);
+    }
+}
+
+// Runs f with the dispatch lock held and the current output set pinned in m_dispatchOutputs
+template <typename F>
+void OscInProcessor::withOutputs(chrono::steady_clock::time_point arrivalTime, F f)
+{
+    lock_guard<mutex> lock(m_dispatchMutex);
+    auto outputs = m_outputSet.read();
+    m_dispatchOutputs = outputs.get();
+    m_dispatchArrivalTime = arrivalTime;
+    f();
+    m_dispatchOutputs = nullptr;
+}
+
+// Sends whatever the outputs have buffered. These are the drain points: the end of an OSC packet,
+// and the end of each run of scheduled messages
+void OscInProcessor::drainOutputs()
+{
+    if (!m_bufferedOutput) {
+        return;
+    }
+    for (auto output : m_dispatchOutputs->all) {
+        output->drain();
     }
 }
 
+// Returns the output whose sticky id is given in outDevice, or nullptr if outDevice is not an id or there is no such output
+MidiOut* OscInProcessor::OutputSet::findById(const char* outDevice) const
+{
+    size_t id = 0;
+    int nDigits = 0;
+    for (const char* p = outDevice; *p != '\0'; p++, nDigits++) {
+        if (*p < '0' || *p > '9' || nDigits == 9)
+            return nullptr;
+        id = id * 10 + (*p - '0');
+    }
+    if (nDigits == 0 || id >= byId.size())
+        return nullptr;
+    return byId[id];
+}
+
+MidiOut* OscInProcessor::OutputSet::findByName(const char* normalizedName) const
+{
+    auto range = byName.equal_range(local_utils::hashName(normalizedName));
+    for (auto it = range.first; it != range.second; ++it) {
+        if (strcmp(it->second->getNormalizedPortName().c_str(), normalizedName) == 0)
+            return it->second;
+    }
+    return nullptr;
+}
+
+void OscInProcessor::ProcessPacket(const char* data, int size, const IpEndpointName& remoteEndpoint)
+{
+    // As soon as the packet is out of the socket
+    m_packetArrivalTime = chrono::steady_clock::now();
+    osc::OscPacketListener::ProcessPacket(data, size, remoteEndpoint);
+}
+
 void OscInProcessor::ProcessMessage(const osc::ReceivedMessage& message, const IpEndpointName& remoteEndpoint)
 {
-    string addressPattern(message.AddressPattern());
-    m_logger.info("Received OSC message with address pattern: {}", addressPattern);
-    dumpOscBody(message);
-
-    regex addressRegex("/(.+?)/(.+)");
-    smatch match;
-    if (regex_match(addressPattern, match, addressRegex)) {
-        // We are interested in groups [1] and [2]. [1] -> device, [3] -> command / raw
-        string rawOutDeviceName = match[1];
-        // don't normalize name if we are given the wildcard name of *
-        if (rawOutDeviceName != "*") {
-            local_utils::safeOscString(rawOutDeviceName);
+    withOutputs(m_packetArrivalTime, [&]() {
+        dispatchMessage(message);
+        drainOutputs();
+    });
+}
+
+void OscInProcessor::dispatchMessage(const osc::ReceivedMessage& message)
+{
+    const char* addressPattern = message.AddressPattern();
+    if (m_logger.shouldLog(spdlog::level::info)) {
+        OSMID_LOG_INFO(m_logger, "Received OSC message with address pattern: {}", addressPattern);
+        dumpOscBody(message);
+    }
+
+    char outDevice[256];
+    const char* command;
+    size_t commandLength;
+    if (!splitAddress(addressPattern, outDevice, sizeof(outDevice), command, commandLength)) {
+        OSMID_LOG_ERROR(m_logger, "No match on address pattern: {}", addressPattern);
+        return;
+    }
+
+    const Command* found = findCommand(command, commandLength);
+    if (found == nullptr) {
+        OSMID_LOG_ERROR(m_logger, "Unknown command on OSC message: {}. Ignoring", command);
+        return;
+    }
+    (this->*(found->handler))(outDevice, message);
+}
+
+// Splits /device/command in a single pass, copying the device normalized to outDevice.
+// The command is the rest of the address after the device (it may contain slashes)
+bool OscInProcessor::splitAddress(const char* addressPattern, char* outDevice, size_t outDeviceSize, const char*& command, size_t& commandLength)
+{
+    if (addressPattern[0] != '/')
+        return false;
+
+    const char* p = addressPattern + 1;
+    size_t deviceLength = 0;
+    while (*p != '/' && *p != '\0') {
+        if (deviceLength + 1 >= outDeviceSize)
+            return false;
+        outDevice[deviceLength++] = *p++;
+    }
+    if (deviceLength == 0 || *p != '/' || p[1] == '\0')
+        return false;
+    outDevice[deviceLength] = '\0';
+
+    // don't normalize name if we are given the wildcard name of *
+    if (!(deviceLength == 1 && outDevice[0] == '*')) {
+        for (size_t i = 0; i < deviceLength; i++) {
+            outDevice[i] = local_utils::safeOscChar(outDevice[i]);
         }
+    }
 
-        const string& command = match[2];
-        const string& outDevice = rawOutDeviceName;
-
-        if (command == "clock") {
-            processClockMessage(outDevice);
-        } else if (command == "raw") {
-            processRawMessage(outDevice, message);
-        } else if (command == "note_on") {
-            processNoteOnMessage(outDevice, message);
-        } else if (command == "note_off") {
-            processNoteOffMessage(outDevice, message);
-        } else if (command == "control_change") {
-            processControlChangeMessage(outDevice, message);
-        } else if (command == "pitch_bend") {
-            processPitchBendMessage(outDevice, message);
-        } else if (command == "channel_pressure") {
-            processChannelPressureMessage(outDevice, message);
-        } else if (command == "poly_pressure") {
-            processPolyPressureMessage(outDevice, message);
-        } else if (command == "start") {
-            processStartMessage(outDevice);
-        } else if (command == "continue") {
-            processContinueMessage(outDevice);
-        } else if (command == "stop") {
-            processStopMessage(outDevice);
-        } else if (command == "active_sensing") {
-            processActiveSenseMessage(outDevice);
-        } else if (command == "program_change") {
-            processProgramChangeMessage(outDevice, message);
-        } else if (command == "log_level") {
-            processLogLevelMessage(message);
-        } else if (command == "log_to_osc") {
-            processLogToOscMessage(message);
-        } else {
-            m_logger.error("Unknown command on OSC message: {}. Ignoring", command);
+    command = p + 1;
+    commandLength = strlen(command);
+    return true;
+}
+
+const OscInProcessor::Command OscInProcessor::s_commands[] = {
+    { "clock", 5, &OscInProcessor::processClockMessage },
+    { "raw", 3, &OscInProcessor::processRawMessage },
+    { "note_on", 7, &OscInProcessor::processNoteOnMessage },
+    { "note_off", 8, &OscInProcessor::processNoteOffMessage },
+    { "control_change", 14, &OscInProcessor::processControlChangeMessage },
+    { "pitch_bend", 10, &OscInProcessor::processPitchBendMessage },
+    { "channel_pressure", 16, &OscInProcessor::processChannelPressureMessage },
+    { "poly_pressure", 13, &OscInProcessor::processPolyPressureMessage },
+    { "start", 5, &OscInProcessor::processStartMessage },
+    { "continue", 8, &OscInProcessor::processContinueMessage },
+    { "stop", 4, &OscInProcessor::processStopMessage },
+    { "active_sensing", 14, &OscInProcessor::processActiveSenseMessage },
+    { "program_change", 14, &OscInProcessor::processProgramChangeMessage },
+    { "log_level", 9, &OscInProcessor::processLogLevelMessage },
+    { "log_to_osc", 10, &OscInProcessor::processLogToOscMessage }
+};
+
+const int OscInProcessor::N_COMMANDS = sizeof(OscInProcessor::s_commands) / sizeof(OscInProcessor::s_commands[0]);
+
+namespace {
+const size_t COMMAND_TABLE_SIZE = 64; // power of 2, comfortably bigger than the number of commands
+
+inline size_t commandHash(const char* command, size_t length)
+{
+    return (length * 7 + (unsigned char)command[0] + (unsigned char)command[length - 1] * 3) & (COMMAND_TABLE_SIZE - 1);
+}
+}
+
+const OscInProcessor::Command* OscInProcessor::findCommand(const char* command, size_t length)
+{
+    // Open addressing table, built on first use
+    static const array<const Command*, COMMAND_TABLE_SIZE> table = [] {
+        array<const Command*, COMMAND_TABLE_SIZE> t;
+        t.fill(nullptr);
+        for (int i = 0; i < N_COMMANDS; i++) {
+            size_t slot = commandHash(s_commands[i].name, s_commands[i].length);
+            while (t[slot] != nullptr)
+                slot = (slot + 1) & (COMMAND_TABLE_SIZE - 1);
+            t[slot] = &s_commands[i];
         }
-    } else {
-        m_logger.error("No match on address pattern: {}", addressPattern);
+        return t;
+    }();
+
+    if (length == 0)
+        return nullptr;
+
+    for (size_t slot = commandHash(command, length); table[slot] != nullptr; slot = (slot + 1) & (COMMAND_TABLE_SIZE - 1)) {
+        const Command* candidate = table[slot];
+        if (candidate->length == length && memcmp(candidate->name, command, length) == 0)
+            return candidate;
     }
+    return nullptr;
 }
 
 void OscInProcessor::dumpOscBody(const osc::ReceivedMessage& message)
 {
-    m_logger.debug("Got {} arguments", message.ArgumentCount());
+    if (!m_logger.shouldLog(spdlog::level::debug)) {
+        return;
+    }
+    OSMID_LOG_DEBUG(m_logger, "Got {} arguments", message.ArgumentCount());
 
     auto arg = message.ArgumentsBegin();
     while (arg != message.ArgumentsEnd()) {
         if (arg->IsFloat())
-            m_logger.debug("F: {}", arg->AsFloat());
+            OSMID_LOG_DEBUG(m_logger, "F: {}", arg->AsFloat());
         else if (arg->IsInt32())
-            m_logger.debug("I: {}", arg->AsInt32());
+            OSMID_LOG_DEBUG(m_logger, "I: {}", arg->AsInt32());
         else if (arg->IsString())
-            m_logger.debug("S: {}", arg->AsString());
+            OSMID_LOG_DEBUG(m_logger, "S: {}", arg->AsString());
         else if (arg->IsBlob())
-            m_logger.debug("B: this is a blob");
+            OSMID_LOG_DEBUG(m_logger, "B: this is a blob");
         else
-            m_logger.debug("X: not sure what this field is");
+            OSMID_LOG_DEBUG(m_logger, "X: not sure what this field is");
 
         arg++;
     }
 }
 
-void OscInProcessor::send(const string& outDevice, const MidiMessage& msg)
+void OscInProcessor::send(const char* outDevice, const MidiMessage& msg)
 {
-    if (outDevice == "*") {
+    if (outDevice[0] == '*' && outDevice[1] == '\0') {
         // send to every known midi device
-        for (auto& output : m_outputs) {
-            output->send(msg);
+        for (auto output : m_dispatchOutputs->all) {
+            output->send(msg, m_dispatchArrivalTime);
         }
     } else {
         // send to the specified midi device
-        // Look for it
-        for (auto& output : m_outputs) {
-            if (output->getNormalizedPortName() == outDevice) {
-                output->send(msg);
-                return;
-            }
+        // The device can be given by its sticky id, or by its name
+        MidiOut* output = m_dispatchOutputs->findById(outDevice);
+        if (output == nullptr) {
+            output = m_dispatchOutputs->findByName(outDevice);
+        }
+        if (output != nullptr) {
+            output->send(msg, m_dispatchArrivalTime);
+            return;
+        }
+        OSMID_LOG_ERROR(m_logger, "Could not find the MIDI device specified in the OSC message: {}", outDevice);
+    }
+}
+
+void OscInProcessor::send(const char* outDevice, const MidiBuffer& messages)
+{
+    if (outDevice[0] == '*' && outDevice[1] == '\0') {
+        for (auto output : m_dispatchOutputs->all) {
+            output->send(messages, m_dispatchArrivalTime);
+        }
+    } else {
+        MidiOut* output = m_dispatchOutputs->findById(outDevice);
+        if (output == nullptr) {
+            output = m_dispatchOutputs->findByName(outDevice);
+        }
+        if (output != nullptr) {
+            output->send(messages, m_dispatchArrivalTime);
+            return;
         }
-        m_logger.error("Could not find the MIDI device specified in the OSC message: {}", outDevice);
+        OSMID_LOG_ERROR(m_logger, "Could not find the MIDI device specified in the OSC message: {}", outDevice);
     }
 }
 
 // FIXME: For now send to all outputs. Later send only to the appropriate outputs
-void OscInProcessor::processRawMessage(const string& outDevice, const osc::ReceivedMessage& message)
+void OscInProcessor::processRawMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     auto arg = message.ArgumentsBegin();
     if (arg->IsBlob()) {
@@ -148,8 +358,8 @@ void OscInProcessor::processRawMessage(const string& outDevice, const osc::Recei
         osc::int32 blobSize; // Use OSC datatype, otherwise croaks on RPi
         arg->AsBlob(blobData, blobSize);
         MidiMessage raw(blobData, blobSize);
-        for (auto& output : m_outputs) {
-            output->send(raw);
+        for (auto output : m_dispatchOutputs->all) {
+            output->send(raw, m_dispatchArrivalTime);
         }
     } else {
         unsigned char midiMessage[1024];
@@ -167,7 +377,7 @@ void OscInProcessor::processRawMessage(const string& outDevice, const osc::Recei
 }
 
 // note_on OSC messages have this layout: channel (int32), note (int32), velocity (int32)
-void OscInProcessor::processNoteOnMessage(const string& outDevice, const osc::ReceivedMessage& message)
+void OscInProcessor::processNoteOnMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     osc::ReceivedMessage::const_iterator arg = message.ArgumentsBegin();
     int channel, note, velocity;
@@ -180,7 +390,7 @@ void OscInProcessor::processNoteOnMessage(const string& outDevice, const osc::Re
             return;
         }
     } catch (const osc::WrongArgumentTypeException&) {
-        m_logger.error("OSC note_on message: Error parsing args. Expected int32, int32, int32.");
+        OSMID_LOG_ERROR(m_logger, "OSC note_on message: Error parsing args. Expected int32, int32, int32.");
         return;
     }
 
@@ -189,46 +399,47 @@ void OscInProcessor::processNoteOnMessage(const string& outDevice, const osc::Re
         MidiMessage midiMessage{ MidiMessage::noteOn(channel, note, (uint8)velocity) };
         send(outDevice, midiMessage);
     } else if (channel <= 0) {
+        // Send to all channels, in one go
+        MidiBuffer allChannels;
         for (int chan = 1; chan <= 16; chan++) {
-            // Send to all channels
-            MidiMessage midiMessage{ MidiMessage::noteOn(chan, note, (uint8)velocity) };
-            send(outDevice, midiMessage);
+            allChannels.addEvent(MidiMessage::noteOn(chan, note, (uint8)velocity), 0);
         }
+        send(outDevice, allChannels);
     }
 }
 
-void OscInProcessor::processClockMessage(const string& outDevice)
+void OscInProcessor::processClockMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     MidiMessage midiMessage{ MidiMessage::midiClock() };
     send(outDevice, midiMessage);
 }
 
-void OscInProcessor::processStartMessage(const string& outDevice)
+void OscInProcessor::processStartMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     MidiMessage midiMessage{ MidiMessage::midiStart() };
     send(outDevice, midiMessage);
 }
 
-void OscInProcessor::processContinueMessage(const string& outDevice)
+void OscInProcessor::processContinueMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     MidiMessage midiMessage{ MidiMessage::midiContinue() };
     send(outDevice, midiMessage);
 }
 
-void OscInProcessor::processStopMessage(const string& outDevice)
+void OscInProcessor::processStopMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     MidiMessage midiMessage{ MidiMessage::midiStop() };
     send(outDevice, midiMessage);
 }
 
-void OscInProcessor::processActiveSenseMessage(const string& outDevice)
+void OscInProcessor::processActiveSenseMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     MidiMessage midiMessage{ MidiMessage() };
     send(outDevice, midiMessage);
 }
 
 // note_off OSC messages have this layout: channel (int32), note (int32), velocity (int32)
-void OscInProcessor::processNoteOffMessage(const string& outDevice, const osc::ReceivedMessage& message)
+void OscInProcessor::processNoteOffMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     osc::ReceivedMessage::const_iterator arg = message.ArgumentsBegin();
     int channel, note, velocity;
@@ -240,7 +451,7 @@ void OscInProcessor::processNoteOffMessage(const string& outDevice, const osc::R
             throw(osc::WrongArgumentTypeException());
         }
     } catch (const osc::WrongArgumentTypeException&) {
-        m_logger.error("OSC note_off message: Error parsing args. Expected int32, int32, int32.");
+        OSMID_LOG_ERROR(m_logger, "OSC note_off message: Error parsing args. Expected int32, int32, int32.");
         return;
     }
 
@@ -249,16 +460,17 @@ void OscInProcessor::processNoteOffMessage(const string& outDevice, const osc::R
         MidiMessage midiMessage{ MidiMessage::noteOff(channel, note, (uint8)velocity) };
         send(outDevice, midiMessage);
     } else {
-        // Send to all channels
+        // Send to all channels, in one go
+        MidiBuffer allChannels;
         for (int chan = 1; chan <= 16; chan++) {
-            MidiMessage midiMessage{ MidiMessage::noteOff(chan, note, (uint8)velocity) };
-            send(outDevice, midiMessage);
+            allChannels.addEvent(MidiMessage::noteOff(chan, note, (uint8)velocity), 0);
         }
+        send(outDevice, allChannels);
     }
 }
 
 // control_change OSC messages have this layout: channel (int32), number (int32), velocity (int32)
-void OscInProcessor::processControlChangeMessage(const string& outDevice, const osc::ReceivedMessage& message)
+void OscInProcessor::processControlChangeMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     osc::ReceivedMessage::const_iterator arg = message.ArgumentsBegin();
     int channel, number, value;
@@ -270,7 +482,7 @@ void OscInProcessor::processControlChangeMessage(const string& outDevice, const
             throw(osc::WrongArgumentTypeException());
         }
     } catch (const osc::WrongArgumentTypeException&) {
-        m_logger.error("OSC control_change message: Error parsing args. Expected int32, int32, int32.");
+        OSMID_LOG_ERROR(m_logger, "OSC control_change message: Error parsing args. Expected int32, int32, int32.");
         return;
     }
 
@@ -279,16 +491,17 @@ void OscInProcessor::processControlChangeMessage(const string& outDevice, const
         MidiMessage midiMessage{ MidiMessage::controllerEvent(channel, number, value) };
         send(outDevice, midiMessage);
     } else {
-        // Send to all channels
+        // Send to all channels, in one go
+        MidiBuffer allChannels;
         for (int chan = 1; chan <= 16; chan++) {
-            MidiMessage midiMessage{ MidiMessage::controllerEvent(chan, number, value) };
-            send(outDevice, midiMessage);
+            allChannels.addEvent(MidiMessage::controllerEvent(chan, number, value), 0);
         }
+        send(outDevice, allChannels);
     }
 }
 
 // pitch_bend OSC messages have this layout: channel (int32), value (int32). Note that the midi resolution for pitch_bend value is 14 bits
-void OscInProcessor::processPitchBendMessage(const string& outDevice, const osc::ReceivedMessage& message)
+void OscInProcessor::processPitchBendMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     osc::ReceivedMessage::const_iterator arg = message.ArgumentsBegin();
     int channel, value;
@@ -299,7 +512,7 @@ void OscInProcessor::processPitchBendMessage(const string& outDevice, const osc:
             throw(osc::WrongArgumentTypeException());
         }
     } catch (const osc::WrongArgumentTypeException&) {
-        m_logger.error("OSC pitch_bend message: Error parsing args. Expected int32, int32.");
+        OSMID_LOG_ERROR(m_logger, "OSC pitch_bend message: Error parsing args. Expected int32, int32.");
         return;
     }
 
@@ -308,16 +521,17 @@ void OscInProcessor::processPitchBendMessage(const string& outDevice, const osc:
         MidiMessage midiMessage{ MidiMessage::pitchWheel(channel, value) };
         send(outDevice, midiMessage);
     } else {
-        // Send to all channels
+        // Send to all channels, in one go
+        MidiBuffer allChannels;
         for (int chan = 1; chan <= 16; chan++) {
-            MidiMessage midiMessage{ MidiMessage::pitchWheel(chan, value) };
-            send(outDevice, midiMessage);
+            allChannels.addEvent(MidiMessage::pitchWheel(chan, value), 0);
         }
+        send(outDevice, allChannels);
     }
 }
 
 // channel_pressure OSC messages have this layout: channel (int32), value (int32).
-void OscInProcessor::processChannelPressureMessage(const string& outDevice, const osc::ReceivedMessage& message)
+void OscInProcessor::processChannelPressureMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     osc::ReceivedMessage::const_iterator arg = message.ArgumentsBegin();
     int channel, value;
@@ -328,7 +542,7 @@ void OscInProcessor::processChannelPressureMessage(const string& outDevice, cons
             throw(osc::WrongArgumentTypeException());
         }
     } catch (const osc::WrongArgumentTypeException&) {
-        m_logger.error("OSC channel_pressure message: Error parsing args. Expected int32, int32.");
+        OSMID_LOG_ERROR(m_logger, "OSC channel_pressure message: Error parsing args. Expected int32, int32.");
         return;
     }
 
@@ -337,16 +551,17 @@ void OscInProcessor::processChannelPressureMessage(const string& outDevice, cons
         MidiMessage midiMessage{ MidiMessage::channelPressureChange(channel, value) };
         send(outDevice, midiMessage);
     } else {
-        // Send to all channels
+        // Send to all channels, in one go
+        MidiBuffer allChannels;
         for (int chan = 1; chan <= 16; chan++) {
-            MidiMessage midiMessage{ MidiMessage::channelPressureChange(chan, value) };
-            send(outDevice, midiMessage);
+            allChannels.addEvent(MidiMessage::channelPressureChange(chan, value), 0);
         }
+        send(outDevice, allChannels);
     }
 }
 
 // poly_pressure OSC messages have this layout: channel (int32), note (int32), velocity (int32)
-void OscInProcessor::processPolyPressureMessage(const string& outDevice, const osc::ReceivedMessage& message)
+void OscInProcessor::processPolyPressureMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     osc::ReceivedMessage::const_iterator arg = message.ArgumentsBegin();
     int channel, note, value;
@@ -358,7 +573,7 @@ void OscInProcessor::processPolyPressureMessage(const string& outDevice, const o
             throw(osc::WrongArgumentTypeException());
         }
     } catch (const osc::WrongArgumentTypeException&) {
-        m_logger.error("OSC poly_pressure message: Error parsing args. Expected int32, int32, int32.");
+        OSMID_LOG_ERROR(m_logger, "OSC poly_pressure message: Error parsing args. Expected int32, int32, int32.");
         return;
     }
 
@@ -367,16 +582,17 @@ void OscInProcessor::processPolyPressureMessage(const string& outDevice, const o
         MidiMessage midiMessage{ MidiMessage::aftertouchChange(channel, note, value) };
         send(outDevice, midiMessage);
     } else {
-        // Send to all channels
+        // Send to all channels, in one go
+        MidiBuffer allChannels;
         for (int chan = 1; chan <= 16; chan++) {
-            MidiMessage midiMessage{ MidiMessage::aftertouchChange(chan, note, value) };
-            send(outDevice, midiMessage);
+            allChannels.addEvent(MidiMessage::aftertouchChange(chan, note, value), 0);
         }
+        send(outDevice, allChannels);
     }
 }
 
 // program_change OSC messages have this layout: channel (int32), program (int32)
-void OscInProcessor::processProgramChangeMessage(const string& outDevice, const osc::ReceivedMessage& message)
+void OscInProcessor::processProgramChangeMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     osc::ReceivedMessage::const_iterator arg = message.ArgumentsBegin();
     int channel, program;
@@ -387,7 +603,7 @@ void OscInProcessor::processProgramChangeMessage(const string& outDevice, const
             throw(osc::WrongArgumentTypeException());
         }
     } catch (const osc::WrongArgumentTypeException&) {
-        m_logger.error("OSC program_change message: Error parsing args. Expected int32, int32.");
+        OSMID_LOG_ERROR(m_logger, "OSC program_change message: Error parsing args. Expected int32, int32.");
         return;
     }
 
@@ -396,15 +612,16 @@ void OscInProcessor::processProgramChangeMessage(const string& outDevice, const
         MidiMessage midiMessage{ MidiMessage::programChange(channel, program) };
         send(outDevice, midiMessage);
     } else {
-        // Send to all channels
+        // Send to all channels, in one go
+        MidiBuffer allChannels;
         for (int chan = 1; chan <= 16; chan++) {
-            MidiMessage midiMessage{ MidiMessage::programChange(chan, program) };
-            send(outDevice, midiMessage);
+            allChannels.addEvent(MidiMessage::programChange(chan, program), 0);
         }
+        send(outDevice, allChannels);
     }
 }
 
-void OscInProcessor::processLogLevelMessage(const osc::ReceivedMessage& message)
+void OscInProcessor::processLogLevelMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     osc::ReceivedMessage::const_iterator arg = message.ArgumentsBegin();
     int level;
@@ -414,13 +631,13 @@ void OscInProcessor::processLogLevelMessage(const osc::ReceivedMessage& message)
             throw(osc::WrongArgumentTypeException());
         }
     } catch (const osc::WrongArgumentTypeException&) {
-        m_logger.error("OSC log_level message: Error parsing args. Expected int32.");
+        OSMID_LOG_ERROR(m_logger, "OSC log_level message: Error parsing args. Expected int32.");
         return;
     }
     m_logger.setLogLevel(level);
 }
 
-void OscInProcessor::processLogToOscMessage(const osc::ReceivedMessage& message)
+void OscInProcessor::processLogToOscMessage(const char* outDevice, const osc::ReceivedMessage& message)
 {
     osc::ReceivedMessage::const_iterator arg = message.ArgumentsBegin();
     int enable;
@@ -430,7 +647,7 @@ void OscInProcessor::processLogToOscMessage(const osc::ReceivedMessage& message)
             throw(osc::WrongArgumentTypeException());
         }
     } catch (const osc::WrongArgumentTypeException&) {
-        m_logger.error("OSC log_to_osc message: Error parsing args. Expected int32.");
+        OSMID_LOG_ERROR(m_logger, "OSC log_to_osc message: Error parsing args. Expected int32.");
         return;
     }
     m_logger.setSendToOSC(enable != 0);
@@ -438,32 +655,97 @@ void OscInProcessor::processLogToOscMessage(const osc::ReceivedMessage& message)
 
 void OscInProcessor::ProcessBundle(const osc::ReceivedBundle& b, const IpEndpointName& remoteEndpoint)
 {
-    m_logger.error("Received OSC bundle. Ignoring for now!");
+    if (m_logger.shouldLog(spdlog::level::info)) {
+        OSMID_LOG_INFO(m_logger, "Received OSC bundle with {} elements", b.ElementCount());
+    }
+    withOutputs(m_packetArrivalTime, [&]() {
+        processBundleElements(b);
+        drainOutputs();
+    });
+}
+
+// Messages whose time has already come (or with the "immediately" timetag) are dispatched right away,
+// and the rest are queued in the scheduler. Nested bundles use their own timetag
+void OscInProcessor::processBundleElements(const osc::ReceivedBundle& bundle)
+{
+    const osc::uint64 immediately = 1;
+    bool dispatchNow = (bundle.TimeTag() == immediately);
+    auto when = local_utils::fromOscTimeTag(bundle.TimeTag());
+    if (!dispatchNow && when <= chrono::system_clock::now()) {
+        dispatchNow = true;
+    }
+
+    for (auto element = bundle.ElementsBegin(); element != bundle.ElementsEnd(); ++element) {
+        if (element->IsBundle()) {
+            processBundleElements(osc::ReceivedBundle(*element));
+        } else if (dispatchNow) {
+            dispatchMessage(osc::ReceivedMessage(*element));
+        } else {
+            m_scheduler->schedule(when, element->Contents(), element->Size());
+        }
+    }
 }
 
 int OscInProcessor::getNMidiOuts() const
 {
-    return static_cast<int>(m_outputs.size());
+    return static_cast<int>(m_outputSet.read()->outputs.size());
 }
 
 int OscInProcessor::getMidiOutId(int n) const
 {
-    return m_outputs[n]->getPortId();
+    return m_outputSet.read()->outputs[n]->getPortId();
+}
+
+uint64_t OscInProcessor::getMidiOutDrainCount(int n) const
+{
+    return m_outputSet.read()->outputs[n]->getDrainCount();
+}
+
+uint64_t OscInProcessor::getMidiOutDrainedEventCount(int n) const
+{
+    return m_outputSet.read()->outputs[n]->getDrainedEventCount();
+}
+
+uint64_t OscInProcessor::getMidiOutFailedDrainCount(int n) const
+{
+    return m_outputSet.read()->outputs[n]->getFailedDrainCount();
+}
+
+size_t OscInProcessor::getMidiOutQueueDepth(int n) const
+{
+    return m_outputSet.read()->outputs[n]->getQueueDepth();
+}
+
+size_t OscInProcessor::getMidiOutMaxQueueDepth(int n) const
+{
+    return m_outputSet.read()->outputs[n]->getMaxQueueDepth();
+}
+
+uint64_t OscInProcessor::getMidiOutQueueOverflows(int n) const
+{
+    return m_outputSet.read()->outputs[n]->getQueueOverflows();
+}
+
+LatencySummary OscInProcessor::takeMidiOutLatency(int n, int statusSlot)
+{
+    return m_outputSet.read()->outputs[n]->takeLatency(statusSlot);
 }
 
 const std::vector<std::string> OscInProcessor::getKnownOscMessages()
 {
-    return std::vector<std::string>{"clock", "raw", "note_on", "note_off", "control_change",
-        "pitch_bend", "channel_pressure", "poly_pressure", "start", "continue", "stop",
-        "active_sensing", "program_change", "log_level", "log_to_osc"};
+    std::vector<std::string> messages;
+    for (int i = 0; i < N_COMMANDS; i++) {
+        messages.push_back(s_commands[i].name);
+    }
+    return messages;
 }
 
 string OscInProcessor::getMidiOutName(int n) const
 {
-    return m_outputs[n]->getPortName();
+    return m_outputSet.read()->outputs[n]->getPortName();
 }
 
 string OscInProcessor::getNormalizedMidiOutName(int n) const
 {
-    return m_outputs[n]->getNormalizedPortName();
+    return m_outputSet.read()->outputs[n]->getNormalizedPortName();
 }
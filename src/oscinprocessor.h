@@ -23,17 +23,31 @@
 #pragma once
 #include <memory.h>
 #include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 #include <string>
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "oscin.h"
 #include "midiout.h"
+#include "oscscheduler.h"
+#include "rcu.h"
 #include "monitorlogger.h"
 
 class OscInProcessor : public osc::OscPacketListener {
 public:
     OscInProcessor(bool local, int oscListenPort);
 
-    void prepareOutputs(const std::vector<std::string>& outputNames);
+    // Outputs that are already open are kept (unless they are in reopenNames), so they don't miss any messages.
+    // Can be called while the input is running
+    void prepareOutputs(const std::vector<std::string>& outputNames, const std::vector<std::string>& reopenNames = std::vector<std::string>());
+
+    // When enabled, the MIDI events generated by one OSC packet (or bundle) are sent together at the end of it
+    void setBufferedOutput(bool buffered);
+    // With a queueSize, every output gets its own thread to send the MIDI, fed by a queue of that many messages.
+    // The OSC is still parsed and dispatched here. Workers can't be stopped, 0 only affects the outputs opened after it
+    void setOutputWorkers(std::size_t queueSize);
 
     void run()
     {
@@ -45,43 +59,103 @@ public:
         m_input->asyncBreak();
     }
 
+    virtual void ProcessPacket(const char* data, int size, const IpEndpointName& remoteEndpoint) override;
     virtual void ProcessMessage(const osc::ReceivedMessage& m, const IpEndpointName& remoteEndpoint) override;
     virtual void ProcessBundle(const osc::ReceivedBundle& b, const IpEndpointName& remoteEndpoint) override;
 
     ~OscInProcessor()
     {
-        m_logger.trace("OscInProcessor destructor");
+        OSMID_LOG_TRACE(m_logger, "OscInProcessor destructor");
     }
 
     int getNMidiOuts() const;
     std::string getMidiOutName(int n) const;
     std::string getNormalizedMidiOutName(int n) const;
     int getMidiOutId(int n) const;
+    bool isBufferedOutput() const { return m_bufferedOutput; }
+    uint64_t getMidiOutDrainCount(int n) const;
+    uint64_t getMidiOutDrainedEventCount(int n) const;
+    uint64_t getMidiOutFailedDrainCount(int n) const;
+    bool hasOutputWorkers() const { return m_outputQueueSize > 0; }
+    std::size_t getMidiOutQueueDepth(int n) const;
+    std::size_t getMidiOutMaxQueueDepth(int n) const;
+    uint64_t getMidiOutQueueOverflows(int n) const;
+    LatencySummary takeMidiOutLatency(int n, int statusSlot);
 
     static const std::vector<std::string> getKnownOscMessages();
 
 private:
-    void send(const std::string& outDevice, const MidiMessage& msg);
-    void processClockMessage(const std::string& outDevice);
-    void processStartMessage(const std::string& outDevice);
-    void processContinueMessage(const std::string& outDevice);
-    void processStopMessage(const std::string& outDevice);
-    void processActiveSenseMessage(const std::string& outDevice);
-    void processRawMessage(const std::string& outDevice, const osc::ReceivedMessage& message);
-    void processNoteOnMessage(const std::string& outDevice, const osc::ReceivedMessage& message);
-    void processNoteOffMessage(const std::string& outDevice, const osc::ReceivedMessage& message);
-    void processControlChangeMessage(const std::string& outDevice, const osc::ReceivedMessage& message);
-    void processPitchBendMessage(const std::string& outDevice, const osc::ReceivedMessage& message);
-    void processChannelPressureMessage(const std::string& outDevice, const osc::ReceivedMessage& message);
-    void processPolyPressureMessage(const std::string& outDevice, const osc::ReceivedMessage& message);
-    void processProgramChangeMessage(const std::string& outDevice, const osc::ReceivedMessage& message);
-    void processLogLevelMessage(const osc::ReceivedMessage& message);
-    void processLogToOscMessage(const osc::ReceivedMessage& message);
+    void dispatchMessage(const osc::ReceivedMessage& message);
+    void processBundleElements(const osc::ReceivedBundle& bundle);
+    template <typename F>
+    void withOutputs(std::chrono::steady_clock::time_point arrivalTime, F f);
+    void drainOutputs();
+    void send(const char* outDevice, const MidiMessage& msg);
+    void send(const char* outDevice, const MidiBuffer& messages);
+    void processClockMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processStartMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processContinueMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processStopMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processActiveSenseMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processRawMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processNoteOnMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processNoteOffMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processControlChangeMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processPitchBendMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processChannelPressureMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processPolyPressureMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processProgramChangeMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processLogLevelMessage(const char* outDevice, const osc::ReceivedMessage& message);
+    void processLogToOscMessage(const char* outDevice, const osc::ReceivedMessage& message);
+
+    // Command dispatch: the command part of the address is looked up in a small hash table
+    typedef void (OscInProcessor::*CommandHandler)(const char* outDevice, const osc::ReceivedMessage& message);
+    struct Command {
+        const char* name;
+        std::size_t length;
+        CommandHandler handler;
+    };
+    static const Command s_commands[];
+    static const int N_COMMANDS;
+    static const Command* findCommand(const char* command, std::size_t length);
+    static bool splitAddress(const char* addressPattern, char* outDevice, std::size_t outDeviceSize, const char*& command, std::size_t& commandLength);
 
     //bool validateMessage(const std::string& warningPre, const std::string& validationString, const osc::ReceivedMessage& message);
     void dumpOscBody(const osc::ReceivedMessage& message);
 
+    // The open outputs and their routing indexes. prepareOutputs publishes a whole new set, so the
+    // message path always sees a consistent one, and reconfiguring never holds up dispatch
+    struct OutputSet {
+        std::vector<std::shared_ptr<MidiOut> > outputs;
+        // Keyed by the hash of the normalized name, so lookups don't allocate
+        std::unordered_multimap<std::size_t, MidiOut*> byName;
+        std::vector<MidiOut*> all;
+        // Indexed by sticky id, for the /<id>/command form of the address. Ids not currently open are nullptr
+        std::vector<MidiOut*> byId;
+
+        void add(const std::shared_ptr<MidiOut>& output);
+        MidiOut* findByName(const char* normalizedName) const;
+        MidiOut* findById(const char* outDevice) const;
+    };
+
     std::unique_ptr<OscIn> m_input;
-    std::vector<std::unique_ptr<MidiOut> > m_outputs;
+    RcuSnapshot<OutputSet> m_outputSet;
+    // The set the current message is being dispatched to
+    const OutputSet* m_dispatchOutputs;
+    // When the packet being processed arrived (receive thread only), and when the one being dispatched did,
+    // or when the scheduler released it. The MIDI latency stats start from there
+    std::chrono::steady_clock::time_point m_packetArrivalTime;
+    std::chrono::steady_clock::time_point m_dispatchArrivalTime;
+    // Messages can be dispatched from the receive thread and from the scheduler thread, and the buffered
+    // outputs (and m_dispatchOutputs) can't be used from both at once. So this lock is on the message path,
+    // besides the one MidiOut takes for each write because JUCE's ALSA client is not thread safe.
+    // prepareOutputs doesn't take it (opening and closing the devices is serialized with the writes by MidiOut)
+    std::mutex m_dispatchMutex;
+    std::unique_ptr<OscScheduler> m_scheduler;
+    // The output settings, and the reconfiguration of the outputs, are only changed with m_configMutex held,
+    // so the outputs prepareOutputs opens always get the latest settings. Atomic because dispatch reads them
+    std::mutex m_configMutex;
+    std::atomic<bool> m_bufferedOutput;
+    std::atomic<std::size_t> m_outputQueueSize;
     MonitorLogger& m_logger{ MonitorLogger::getInstance() };
 };
@@ -21,19 +21,115 @@
 // SOFTWARE.
 #include <iomanip>
 #include <iostream>
+#include <cstring>
 #include "oscout.h"
+#include "realtime.h"
 #include "utils.h"
 
 using namespace std;
 
 OscOutput::OscOutput(const string& dstOscHost, int dstOscPort)
+    : m_port(dstOscPort),
+      m_batching(false),
+      m_nBatched(0),
+      m_exitBatchThread(false),
+      m_packetsSent(0),
+      m_sendCalls(0)
 {
     m_transmitSocket = make_unique<UdpTransmitSocket>(IpEndpointName(dstOscHost.c_str(), dstOscPort));
 }
 
+OscOutput::~OscOutput()
+{
+    if (m_batchThread.joinable()) {
+        {
+            lock_guard<mutex> lock(m_sendMutex);
+            m_exitBatchThread = true;
+        }
+        m_batchCondition.notify_one();
+        m_batchThread.join();
+    }
+    flush();
+}
+
 void OscOutput::sendUDP(const char* data, size_t size)
 {
     // it is not thread safe to share udp objects...
     lock_guard<mutex> lock(m_sendMutex);
+    if (!m_batching || size > MAX_BATCH_PACKET_SIZE) {
+        sendLocked(data, size);
+        return;
+    }
+
+    memcpy(&m_batchData[m_nBatched * MAX_BATCH_PACKET_SIZE], data, size);
+    m_batchSizes[m_nBatched] = size;
+    if (m_nBatched++ == 0) {
+        m_batchDeadline = chrono::steady_clock::now() + m_maxDelay;
+        m_batchCondition.notify_one();
+    }
+    if (m_nBatched == MAX_BATCH_PACKETS) {
+        flushLocked();
+    }
+}
+
+void OscOutput::sendUDPNow(const char* data, size_t size)
+{
+    lock_guard<mutex> lock(m_sendMutex);
+    sendLocked(data, size);
+}
+
+void OscOutput::sendLocked(const char* data, size_t size)
+{
+    flushLocked();
     m_transmitSocket->Send(data, size);
+    m_packetsSent++;
+    m_sendCalls++;
+}
+
+void OscOutput::enableBatching(chrono::microseconds maxDelay)
+{
+    lock_guard<mutex> lock(m_sendMutex);
+    if (m_batching)
+        return;
+
+    m_maxDelay = maxDelay;
+    m_batchData.resize(MAX_BATCH_PACKETS * MAX_BATCH_PACKET_SIZE);
+    for (int i = 0; i < MAX_BATCH_PACKETS; i++) {
+        m_batchPackets[i] = &m_batchData[i * MAX_BATCH_PACKET_SIZE];
+    }
+    m_batching = true;
+    m_batchThread = thread(&OscOutput::batchFlushThread, this);
+}
+
+void OscOutput::flush()
+{
+    lock_guard<mutex> lock(m_sendMutex);
+    flushLocked();
+}
+
+void OscOutput::flushLocked()
+{
+    if (m_nBatched == 0)
+        return;
+
+    m_sendCalls += m_transmitSocket->SendMultiple(m_batchPackets, m_batchSizes, m_nBatched);
+    m_packetsSent += m_nBatched;
+    m_nBatched = 0;
+}
+
+// Sends whatever is queued once the oldest packet has waited for the max delay
+void OscOutput::batchFlushThread()
+{
+    realtime::setupCurrentThread("OSC batch sender");
+    unique_lock<mutex> lock(m_sendMutex);
+    while (!m_exitBatchThread) {
+        if (m_nBatched == 0) {
+            m_batchCondition.wait(lock);
+            continue;
+        }
+        m_batchCondition.wait_until(lock, m_batchDeadline);
+        if (m_nBatched > 0 && chrono::steady_clock::now() >= m_batchDeadline) {
+            flushLocked();
+        }
+    }
 }
@@ -24,17 +24,58 @@
 #include <string>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
 #include "ip/UdpSocket.h"
 //#include "monitorlogger.h"
 
 class OscOutput {
 public:
     OscOutput(const std::string& dstOscHost, int dstOscPort);
+    ~OscOutput();
     void sendUDP(const char* data, std::size_t size);
+    // Never batched, for the packets that are not part of a burst (heartbeat, stats, logging).
+    // Whatever is batched goes first, so the order is kept
+    void sendUDPNow(const char* data, std::size_t size);
+
+    // In batching mode packets are queued and sent together (with sendmmsg on Linux). Producers call flush()
+    // at the end of each burst, and maxDelay after the first packet was queued is only the upper bound
+    void enableBatching(std::chrono::microseconds maxDelay);
+    void flush();
+
+    int getPort() const { return m_port; }
+    std::uint64_t getPacketsSent() const { return m_packetsSent; }
+    std::uint64_t getSendCalls() const { return m_sendCalls; }
 
 private:
+    void flushLocked();
+    void sendLocked(const char* data, std::size_t size);
+    void batchFlushThread();
+
+    static const int MAX_BATCH_PACKETS = 64;
+    static const std::size_t MAX_BATCH_PACKET_SIZE = 2048;
+
     //void dumpMessage(const char *data, size_t size);
     std::unique_ptr<UdpTransmitSocket> m_transmitSocket;
     std::mutex m_sendMutex;
+    int m_port;
+
+    bool m_batching;
+    std::chrono::microseconds m_maxDelay;
+    std::vector<char> m_batchData;
+    const char* m_batchPackets[MAX_BATCH_PACKETS];
+    std::size_t m_batchSizes[MAX_BATCH_PACKETS];
+    int m_nBatched;
+    std::chrono::steady_clock::time_point m_batchDeadline;
+    std::condition_variable m_batchCondition;
+    std::thread m_batchThread;
+    bool m_exitBatchThread;
+
+    std::atomic<std::uint64_t> m_packetsSent;
+    std::atomic<std::uint64_t> m_sendCalls;
     //MonitorLogger &m_logger{ MonitorLogger::getInstance() };
 };
\ No newline at end of file
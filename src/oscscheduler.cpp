@@ -0,0 +1,107 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <algorithm>
+#include "oscscheduler.h"
+#include "realtime.h"
+
+using namespace std;
+
+OscScheduler::OscScheduler(Dispatcher dispatcher, AfterDispatch afterDispatch)
+    : m_dispatcher(dispatcher),
+      m_afterDispatch(afterDispatch),
+      m_nextSequence(0),
+      m_exit(false)
+{
+    m_thread = thread(&OscScheduler::dispatchThread, this);
+}
+
+OscScheduler::~OscScheduler()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+}
+
+bool OscScheduler::isLater(const ScheduledMessage& lhs, const ScheduledMessage& rhs)
+{
+    if (lhs.when != rhs.when)
+        return lhs.when > rhs.when;
+    return lhs.sequence > rhs.sequence;
+}
+
+void OscScheduler::schedule(chrono::system_clock::time_point when, const char* data, size_t size)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_queue.push_back(ScheduledMessage{ when, m_nextSequence++, vector<char>(data, data + size) });
+    push_heap(m_queue.begin(), m_queue.end(), isLater);
+    // Only need to wake up the thread if this is now the first message to go
+    if (m_queue.front().sequence == m_nextSequence - 1) {
+        m_condition.notify_one();
+    }
+}
+
+void OscScheduler::dispatchThread()
+{
+    realtime::setupCurrentThread("OSC scheduler");
+    unique_lock<mutex> lock(m_mutex);
+    bool dispatched = false;
+    while (!m_exit) {
+        bool due = !m_queue.empty() && chrono::system_clock::now() >= m_queue.front().when;
+        if (!due && dispatched) {
+            dispatched = false;
+            if (m_afterDispatch) {
+                lock.unlock();
+                m_afterDispatch();
+                lock.lock();
+                continue;
+            }
+        }
+
+        if (m_queue.empty()) {
+            m_condition.wait(lock);
+            continue;
+        }
+        if (chrono::system_clock::now() < m_queue.front().when) {
+            m_condition.wait_until(lock, m_queue.front().when);
+            continue;
+        }
+
+        pop_heap(m_queue.begin(), m_queue.end(), isLater);
+        ScheduledMessage scheduled = std::move(m_queue.back());
+        m_queue.pop_back();
+
+        // Don't hold the lock while sending, so that the receiving thread can keep scheduling
+        lock.unlock();
+        try {
+            osc::ReceivedPacket packet(scheduled.data.data(), static_cast<osc::osc_bundle_element_size_t>(scheduled.data.size()));
+            m_dispatcher(osc::ReceivedMessage(packet));
+        } catch (const osc::Exception& e) {
+            OSMID_LOG_ERROR(m_logger, "Error dispatching scheduled OSC message: {}", e.what());
+        }
+        dispatched = true;
+        lock.lock();
+    }
+}
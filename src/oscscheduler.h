@@ -0,0 +1,70 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <cstdint>
+#include "osc/OscReceivedElements.h"
+#include "monitorlogger.h"
+
+// Holds OSC messages that came in timetagged bundles until their time arrives,
+// and then dispatches them from its own thread, so that network jitter does not affect the MIDI timing
+class OscScheduler {
+public:
+    typedef std::function<void(const osc::ReceivedMessage&)> Dispatcher;
+    typedef std::function<void()> AfterDispatch;
+
+    // afterDispatch, if given, is called after a run of messages that were due at the same time has been dispatched
+    explicit OscScheduler(Dispatcher dispatcher, AfterDispatch afterDispatch = nullptr);
+    OscScheduler(const OscScheduler&) = delete;
+    OscScheduler& operator=(const OscScheduler&) = delete;
+    ~OscScheduler();
+
+    // data points to a complete OSC message, which is copied
+    void schedule(std::chrono::system_clock::time_point when, const char* data, std::size_t size);
+
+private:
+    struct ScheduledMessage {
+        std::chrono::system_clock::time_point when;
+        std::uint64_t sequence; // keeps the arrival order of messages with the same time
+        std::vector<char> data;
+    };
+
+    // For a min-heap on the time
+    static bool isLater(const ScheduledMessage& lhs, const ScheduledMessage& rhs);
+    void dispatchThread();
+
+    Dispatcher m_dispatcher;
+    AfterDispatch m_afterDispatch;
+    std::vector<ScheduledMessage> m_queue;
+    std::uint64_t m_nextSequence;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::thread m_thread;
+    bool m_exit;
+    MonitorLogger& m_logger{ MonitorLogger::getInstance() };
+};
@@ -0,0 +1,150 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <cstring>
+#include "osctemplate.h"
+
+using namespace std;
+
+namespace {
+// Small helper to append to a fixed size buffer, folding the double slash cleanup into the expansion
+class AddressWriter {
+public:
+    AddressWriter(char* buffer, size_t bufferSize)
+        : m_buffer(bufferSize > 0 ? buffer : nullptr)
+        , m_capacity(bufferSize > 0 ? bufferSize - 1 : 0)
+        , m_length(0)
+    {
+    }
+
+    void append(char c)
+    {
+        if (c == '/' && m_length > 0 && m_buffer[m_length - 1] == '/')
+            return;
+        if (m_length < m_capacity)
+            m_buffer[m_length++] = c;
+    }
+
+    void append(const char* str, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+            append(str[i]);
+    }
+
+    void append(int value)
+    {
+        char digits[12];
+        int nDigits = 0;
+        unsigned int uvalue = static_cast<unsigned int>(value);
+        if (value < 0) {
+            append('-');
+            uvalue = 0u - uvalue;
+        }
+        do {
+            digits[nDigits++] = static_cast<char>('0' + uvalue % 10);
+            uvalue /= 10;
+        } while (uvalue != 0);
+        while (nDigits > 0)
+            append(digits[--nDigits]);
+    }
+
+    size_t finish()
+    {
+        if (m_length > 1 && m_buffer[m_length - 1] == '/')
+            m_length--;
+        if (m_buffer != nullptr)
+            m_buffer[m_length] = '\0';
+        return m_length;
+    }
+
+private:
+    char* m_buffer;
+    size_t m_capacity;
+    size_t m_length;
+};
+}
+
+OscTemplate::OscTemplate(const string& oscTemplate)
+{
+    size_t literalStart = 0;
+    auto flushLiteral = [&](size_t end) {
+        if (end > literalStart) {
+            m_tokens.push_back({ TokenType::Literal, m_literals.size(), end - literalStart });
+            m_literals.append(oscTemplate, literalStart, end - literalStart);
+        }
+    };
+
+    for (size_t i = 0; i < oscTemplate.size(); i++) {
+        if (oscTemplate[i] != '$' || i + 1 >= oscTemplate.size())
+            continue;
+
+        TokenType type;
+        switch (oscTemplate[i + 1]) {
+        case 'n':
+            type = TokenType::PortName;
+            break;
+        case 'i':
+            type = TokenType::PortId;
+            break;
+        case 'c':
+            type = TokenType::Channel;
+            break;
+        case 'm':
+            type = TokenType::MessageType;
+            break;
+        default:
+            // Not a placeholder, keep it as part of the literal
+            continue;
+        }
+        flushLiteral(i);
+        m_tokens.push_back({ type, 0, 0 });
+        i++;
+        literalStart = i + 1;
+    }
+    flushLiteral(oscTemplate.size());
+}
+
+size_t OscTemplate::expand(char* buffer, size_t bufferSize, const string& portName, int portId, int channel, const char* messageType) const
+{
+    AddressWriter writer(buffer, bufferSize);
+    for (const auto& token : m_tokens) {
+        switch (token.type) {
+        case TokenType::Literal:
+            writer.append(m_literals.data() + token.offset, token.length);
+            break;
+        case TokenType::PortName:
+            writer.append(portName.data(), portName.size());
+            break;
+        case TokenType::PortId:
+            writer.append(portId);
+            break;
+        case TokenType::Channel:
+            if (channel != 0xff)
+                writer.append(channel);
+            break;
+        case TokenType::MessageType:
+            writer.append(messageType, strlen(messageType));
+            break;
+        }
+    }
+    return writer.finish();
+}
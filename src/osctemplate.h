@@ -0,0 +1,61 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// An OSC address template (as passed with -t), parsed once into a list of tokens so that
+// expanding it for every MIDI message does not need any regex or heap allocation.
+// Supported placeholders are $n: midi port name, $i: midi port id, $c: midi channel, $m: message type
+class OscTemplate {
+public:
+    OscTemplate() = default;
+    explicit OscTemplate(const std::string& oscTemplate);
+
+    bool empty() const { return m_tokens.empty(); }
+
+    // Expands the template into buffer (always null terminated), collapsing repeated slashes
+    // (e.g. when the message has no channel) and removing a trailing slash.
+    // channel should be 0xff for messages without channel. Returns the length of the expanded address
+    std::size_t expand(char* buffer, std::size_t bufferSize, const std::string& portName, int portId, int channel, const char* messageType) const;
+
+private:
+    enum class TokenType {
+        Literal,
+        PortName,
+        PortId,
+        Channel,
+        MessageType
+    };
+
+    struct Token {
+        TokenType type;
+        std::size_t offset; // into m_literals, only for Literal tokens
+        std::size_t length;
+    };
+
+    std::string m_literals;
+    std::vector<Token> m_tokens;
+};
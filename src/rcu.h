@@ -0,0 +1,124 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Holds an immutable snapshot of T that readers can use without taking any lock (RCU style).
+// Writers publish a new snapshot, and the old one is deleted once every reader that could
+// still see it is done with it. Readers are cheap, writers are slow and meant to be rare.
+//
+// Readers register in one of two counters, picked by the parity of the epoch. A writer flips
+// the epoch twice, waiting for the counter of the previous parity to drain each time, so
+// any reader that could have loaded the old pointer is gone when the old snapshot is deleted.
+template <typename T>
+class RcuSnapshot {
+public:
+    class ReadGuard {
+    public:
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+        ReadGuard(ReadGuard&& other) : m_counter(other.m_counter), m_snapshot(other.m_snapshot)
+        {
+            other.m_counter = nullptr;
+        }
+        ~ReadGuard()
+        {
+            if (m_counter)
+                m_counter->fetch_sub(1, std::memory_order_release);
+        }
+
+        const T* get() const { return m_snapshot; }
+        const T* operator->() const { return m_snapshot; }
+        const T& operator*() const { return *m_snapshot; }
+
+    private:
+        friend class RcuSnapshot;
+        ReadGuard(std::atomic<int>* counter, const T* snapshot) : m_counter(counter), m_snapshot(snapshot) {}
+        std::atomic<int>* m_counter;
+        const T* m_snapshot;
+    };
+
+    explicit RcuSnapshot(std::unique_ptr<T> initial = std::unique_ptr<T>(new T()))
+        : m_current(initial.release()),
+          m_epoch(0)
+    {
+        m_readers[0] = 0;
+        m_readers[1] = 0;
+    }
+    RcuSnapshot(const RcuSnapshot&) = delete;
+    RcuSnapshot& operator=(const RcuSnapshot&) = delete;
+
+    ~RcuSnapshot()
+    {
+        delete m_current.load();
+    }
+
+    // The snapshot stays valid while the guard is alive. Never blocks
+    ReadGuard read() const
+    {
+        while (true) {
+            unsigned int epoch = m_epoch.load();
+            std::atomic<int>* counter = &m_readers[epoch & 1];
+            counter->fetch_add(1);
+            // If a writer flipped the epoch in between, it may not wait for this counter, so register again
+            if (m_epoch.load() == epoch)
+                return ReadGuard(counter, m_current.load());
+            counter->fetch_sub(1);
+        }
+    }
+
+    // Replaces the snapshot, and deletes the old one when no reader can be using it anymore.
+    // Must not be called while holding a ReadGuard on this same snapshot
+    void publish(std::unique_ptr<T> next)
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        std::unique_ptr<const T> old(m_current.exchange(next.release()));
+        synchronizeLocked();
+    }
+
+    // Waits until every reader that started before the call is done
+    void synchronize()
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        synchronizeLocked();
+    }
+
+private:
+    void synchronizeLocked()
+    {
+        for (int flip = 0; flip < 2; flip++) {
+            unsigned int previous = m_epoch.fetch_add(1);
+            while (m_readers[previous & 1].load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    std::atomic<const T*> m_current;
+    mutable std::atomic<unsigned int> m_epoch;
+    mutable std::atomic<int> m_readers[2];
+    std::mutex m_writeMutex;
+};
@@ -0,0 +1,159 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#if WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "realtime.h"
+#include "monitorlogger.h"
+
+using namespace std;
+
+namespace realtime {
+
+static int s_priority = 0;
+static vector<int> s_cpus;
+static atomic<bool> s_priorityWarned(false);
+static atomic<bool> s_affinityWarned(false);
+
+void setThreadOptions(int priority, const vector<int>& cpus)
+{
+    s_priority = priority;
+    s_cpus = cpus;
+}
+
+static void setPriority(const char* threadName)
+{
+    auto& logger = MonitorLogger::getInstance();
+#if WIN32
+    bool ok = (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0);
+    int err = static_cast<int>(GetLastError());
+#else
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = s_priority;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    bool ok = (err == 0);
+#endif
+    if (ok) {
+        OSMID_LOG_DEBUG(logger, "Thread {} running with realtime priority {}", threadName, s_priority);
+    } else if (!s_priorityWarned.exchange(true)) {
+        OSMID_LOG_WARN(logger, "Could not set realtime priority {} for thread {} (error {}), running with normal priority. "
+                    "On Linux this needs CAP_SYS_NICE or an rtprio limit in /etc/security/limits.conf",
+            s_priority, threadName, err);
+    }
+}
+
+static void setAffinity(const char* threadName)
+{
+    auto& logger = MonitorLogger::getInstance();
+#if WIN32
+    DWORD_PTR mask = 0;
+    for (int cpu : s_cpus) {
+        if (cpu >= 0 && cpu < static_cast<int>(sizeof(DWORD_PTR) * 8))
+            mask |= static_cast<DWORD_PTR>(1) << cpu;
+    }
+    bool ok = (mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0);
+    int err = static_cast<int>(GetLastError());
+#elif defined(__linux__)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (int cpu : s_cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &cpuSet);
+    }
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+    bool ok = (err == 0);
+#else
+    // macOS only has affinity hints, no pinning
+    bool ok = false;
+    int err = 0;
+#endif
+    if (ok) {
+        OSMID_LOG_DEBUG(logger, "Thread {} pinned to {} CPUs", threadName, s_cpus.size());
+    } else if (!s_affinityWarned.exchange(true)) {
+        OSMID_LOG_WARN(logger, "Could not pin thread {} to the given CPUs (error {}), it can run on any of them", threadName, err);
+    }
+}
+
+void setupCurrentThread(const char* threadName)
+{
+    if (s_priority > 0)
+        setPriority(threadName);
+    if (!s_cpus.empty())
+        setAffinity(threadName);
+}
+
+void setupCurrentThreadOnce(const char* threadName)
+{
+    static thread_local bool done = false;
+    if (done)
+        return;
+    done = true;
+    setupCurrentThread(threadName);
+}
+
+// Touches this much stack, so it is already mapped when a thread needs it
+static void prefaultStack()
+{
+    const size_t stackSize = 256 * 1024;
+    volatile char stack[stackSize];
+    for (size_t i = 0; i < stackSize; i += 4096) {
+        stack[i] = 0;
+    }
+    (void)stack[0];
+}
+
+bool lockMemory()
+{
+    auto& logger = MonitorLogger::getInstance();
+#if WIN32
+    OSMID_LOG_WARN(logger, "Locking the memory is not supported on Windows");
+    return false;
+#else
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        OSMID_LOG_WARN(logger, "Could not lock the memory ({}), page faults may cause latency spikes. "
+                    "On Linux this needs CAP_IPC_LOCK or a big enough memlock limit",
+            strerror(errno));
+        return false;
+    }
+#ifdef __GLIBC__
+    // Keep freed memory in the process, so it doesn't have to be faulted in again
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+#endif
+    prefaultStack();
+    OSMID_LOG_DEBUG(logger, "Memory locked");
+    return true;
+#endif
+}
+}
@@ -0,0 +1,42 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <vector>
+
+// Realtime settings for the threads that MIDI and OSC go through on their way (MIDI input, OSC receive,
+// the sender and flush threads). Threads that are not latency critical, like the hotplug watcher, are left alone
+namespace realtime {
+// Call once at startup, before any of those threads start. A priority of 0 leaves the scheduling alone,
+// and no cpus leaves the affinity alone
+void setThreadOptions(int priority, const std::vector<int>& cpus);
+
+// Gives the calling thread SCHED_FIFO at the configured priority and pins it to the configured CPUs.
+// When that is not allowed (no CAP_SYS_NICE or rtprio limit), it warns once and the thread carries on as it was
+void setupCurrentThread(const char* threadName);
+// The same, for threads we don't start ourselves and only see from their callbacks. Only does the work the first time on each thread
+void setupCurrentThreadOnce(const char* threadName);
+
+// Locks the current and future memory of the process and pre-faults the stack, so that page faults
+// don't show up as latency spikes later. Warns and returns false if it's not allowed
+bool lockMemory();
+}
@@ -0,0 +1,80 @@
+// MIT License
+
+// Copyright (c) 2016 Luis Lloret
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Fixed size ring buffer for exactly one producer thread and one consumer thread, without locks.
+// The capacity is rounded up to a power of two. push() fails when the ring is full, it never waits
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(std::size_t capacity) : m_head(0), m_tail(0)
+    {
+        std::size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_items.resize(size);
+        m_mask = size - 1;
+    }
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer only
+    bool push(const T& item)
+    {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+            return false;
+        m_items[tail & m_mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only
+    bool pop(T& item)
+    {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        item = m_items[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only a snapshot while the other end is running
+    std::size_t size() const { return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+    std::size_t capacity() const { return m_mask + 1; }
+
+private:
+    std::vector<T> m_items;
+    std::size_t m_mask;
+    // The two ends are written by different threads, keep them in different cache lines
+    char m_pad0[64];
+    std::atomic<std::size_t> m_head;
+    char m_pad1[64];
+    std::atomic<std::size_t> m_tail;
+    char m_pad2[64];
+};
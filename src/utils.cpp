@@ -39,6 +39,13 @@ void downcase(string& str)
 }
 
 void safeOscString(string& str)
+{
+    for (auto& c : str) {
+        c = safeOscChar(c);
+    }
+}
+
+char safeOscChar(char c)
 {
   /*ASCII characters not allowed in names of OSC paths
     See: http://opensoundcontrol.org/spec-1_0
@@ -53,32 +60,64 @@ void safeOscString(string& str)
     {   open curly brace  123
     }   close curly brace 125
   */
+    switch (c) {
+    case ' ':
+    case '#':
+    case '*':
+    case ',':
+    case '/':
+    case '?':
+    case '[':
+    case ']':
+    case '{':
+    case '}':
+        return '_';
+    default:
+        return static_cast<char>(::tolower(static_cast<unsigned char>(c)));
+    }
+}
 
-    replace_chars(str, ' ', '_');
-    replace_chars(str, '#', '_');
-    replace_chars(str, '*', '_');
-    replace_chars(str, ',', '_');
-    replace_chars(str, '/', '_');
-    replace_chars(str, '?', '_');
-    replace_chars(str, '[', '_');
-    replace_chars(str, ']', '_');
-    replace_chars(str, '{', '_');
-    replace_chars(str, '}', '_');
-    downcase(str);
+size_t hashName(const char* str)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    while (*str != '\0') {
+        hash ^= static_cast<unsigned char>(*str++);
+        hash *= 1099511628211ULL;
+    }
+    return static_cast<size_t>(hash);
 }
 
 void logOSCMessage(const char* data, size_t size)
 {
-    MonitorLogger::getInstance().trace("sent UDP message: ");
+    if (!MonitorLogger::getInstance().shouldLog(spdlog::level::trace)) {
+        return;
+    }
+    OSMID_LOG_TRACE(MonitorLogger::getInstance(), "sent UDP message: ");
     for (int i = 0; i < size; i++) {
         const unsigned char udata = (unsigned char)(data[i]);
         // is it printable?
         if (udata >= 32 && udata <= 127)
-            MonitorLogger::getInstance().trace("{}", udata);
+            OSMID_LOG_TRACE(MonitorLogger::getInstance(), "{}", udata);
         else
-            MonitorLogger::getInstance().trace("[{:02x}]", udata);
+            OSMID_LOG_TRACE(MonitorLogger::getInstance(), "[{:02x}]", udata);
     }
 }
 
+// Seconds between 1900 (NTP epoch) and 1970 (Unix epoch)
+static const uint64_t ntpUnixOffset = 2208988800ULL;
 
+uint64_t toOscTimeTag(chrono::system_clock::time_point time)
+{
+    auto sinceEpoch = chrono::duration_cast<chrono::nanoseconds>(time.time_since_epoch()).count();
+    uint64_t seconds = sinceEpoch / 1000000000 + ntpUnixOffset;
+    uint64_t fraction = ((uint64_t)(sinceEpoch % 1000000000) << 32) / 1000000000;
+    return (seconds << 32) | fraction;
+}
+
+chrono::system_clock::time_point fromOscTimeTag(uint64_t timeTag)
+{
+    uint64_t seconds = (timeTag >> 32) - ntpUnixOffset;
+    uint64_t nanoseconds = ((timeTag & 0xffffffffULL) * 1000000000) >> 32;
+    return chrono::system_clock::time_point(chrono::duration_cast<chrono::system_clock::duration>(chrono::seconds(seconds) + chrono::nanoseconds(nanoseconds)));
+}
 }
@@ -24,10 +24,18 @@
 
 #include <string>
 #include <memory>
+#include <chrono>
+#include <cstdint>
 
 namespace local_utils {
 void replace_chars(std::string& str, char from, char to);
 void downcase(std::string& str);
 void safeOscString(std::string& str);
+char safeOscChar(char c);
+// FNV-1a hash of a nul terminated string. Used for allocation-free lookups by name
+std::size_t hashName(const char* str);
 void logOSCMessage(const char* data, size_t size);
+// OSC time tags are NTP timestamps: seconds since 1900 in the high 32 bits, and fraction of second in the low 32 bits
+uint64_t toOscTimeTag(std::chrono::system_clock::time_point time);
+std::chrono::system_clock::time_point fromOscTimeTag(uint64_t timeTag);
 }